@@ -13,6 +13,7 @@
 #include "httpDownloadImpl/CprHttpDownload.h"
 #endif
 #include "PayloadDefs.h"
+#include "common/CpuTopology.h"
 
 namespace skkk {
 	enum ExtractResult {
@@ -41,6 +42,9 @@ namespace skkk {
 			std::map<std::string, std::string> outConfig;
 			std::string targetName;
 			std::vector<std::string> targets;
+			std::string costProfilePath;
+			// Extracted first, in this order
+			std::vector<std::string> priorities;
 
 		public:
 			int payloadType = PAYLOAD_TYPE_ZIP;
@@ -56,9 +60,27 @@ namespace skkk {
 			bool isUrl = false;
 			bool remoteUpdate = false;
 			bool sslVerification = true;
+			int scheduleMode = SCHEDULE_MANIFEST;
 			uint32_t threadNum = 0;
-			uint32_t hardwareConcurrency = std::thread::hardware_concurrency();
+			// Respects the affinity mask and cgroup cpu quota
+			uint32_t hardwareConcurrency = CpuTopology::availableCpus();
 			uint32_t limitHardwareConcurrency = hardwareConcurrency * 3;
+			// Pin the workers to these cpus, empty: not pinned
+			std::vector<uint32_t> cpuSet;
+			bool isNumaBind = false;
+			// Adjust the active threads from the measured throughput, threadNum is the maximum
+			bool isAdaptiveThreads = false;
+			// Scratch memory of the running operations in bytes, 0: unlimited
+			uint64_t maxMemory = 0;
+			// URL mode download threads, 0: same as threadNum
+			uint32_t fetchThreadNum = 0;
+			// Only extract the operations of shard shardIndex of shardCount, shardCount < 2: all
+			uint32_t shardIndex = 0;
+			uint32_t shardCount = 0;
+			// Tasks of this payload running at the same time on a shared pool, 0: unlimited
+			uint32_t jobThreadNum = 0;
+			// Write Android sparse images instead of raw images
+			bool isSparseOutput = false;
 			std::shared_ptr<HttpDownload> httpDownload;
 
 		public:
@@ -67,6 +89,13 @@ namespace skkk {
 			ExtractConfig(int payloadType, const std::string &payloadPath, const std::string &oldDir,
 			              const std::string &outDir, bool sslVerification);
 
+			/**
+			 * Copies the options, the download of the payload is not shared: it is bound to payloadPath.
+			 */
+			ExtractConfig(const ExtractConfig &other);
+
+			ExtractConfig &operator=(const ExtractConfig &) = delete;
+
 			virtual ~ExtractConfig() = default;
 
 			virtual const std::string &getOldDir() const;
@@ -95,6 +124,14 @@ namespace skkk {
 
 			virtual void setTargets(const std::vector<std::string> &target);
 
+			virtual const std::string &getCostProfilePath() const;
+
+			virtual void setCostProfilePath(const std::string &path);
+
+			virtual const std::vector<std::string> &getPriorities() const;
+
+			virtual void setPriorities(const std::vector<std::string> &names);
+
 			virtual const std::shared_ptr<HttpDownload> &getHttpDownloadImpl();
 	};
 }
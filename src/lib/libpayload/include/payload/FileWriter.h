@@ -4,32 +4,59 @@
 #include <functional>
 
 #include "HttpDownload.h"
+#include "JobPool.h"
 #include "PartitionInfo.h"
+#include "common/Buffer.hpp"
 
 namespace skkk {
 	class FileWriter {
 		using decompressPtr = std::function<int(const uint8_t *src, uint64_t srcSize,
-		                                        uint8_t *dest, uint64_t destSize)>;
+		                                        uint8_t *outData, const std::vector<Extent> &extents)>;
+		using patchPtr = std::function<int(const uint8_t *src, uint64_t srcSize, const uint8_t *patch,
+		                                   uint64_t patchSize, uint8_t *dest, uint64_t destSize)>;
 
 		const std::shared_ptr<HttpDownload> &httpDownload;
+		// Idle workers of the job help to decode the blocks of large operations, may be nullptr
+		JobPool *jobPool = nullptr;
 
 		public:
-			FileWriter(const std::shared_ptr<HttpDownload> &httpDownload);
+			// Smallest REPLACE_BZ/REPLACE_XZ operation decoded block parallel
+			static constexpr uint64_t PARALLEL_DECODE_MIN_SIZE = 32 * 1024 * 1024;
+
+		public:
+			FileWriter(const std::shared_ptr<HttpDownload> &httpDownload, JobPool *jobPool = nullptr);
 
 			int urlRead(uint8_t *buf, const FileOperation &operation) const;
 
-			int commonWrite(const decompressPtr &decompress, const uint8_t *payloadData, uint8_t *outData,
+			/**
+			 * Payload data of the operation, downloaded into buffer in URL mode,
+			 * nullptr if the operation has no data.
+			 */
+			const uint8_t *readOperationData(const uint8_t *payloadData, const FileOperation &operation,
+			                                 Buffer<uint8_t> &buffer) const;
+
+			/**
+			 * Every extent starts where the previous one ends
+			 */
+			static bool isContiguous(const std::vector<Extent> &extents);
+
+			int commonWrite(const decompressPtr &decompress, const uint8_t *srcData, uint8_t *outData,
 			                const FileOperation &operation) const;
 
-			int directWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) const;
+			int directWrite(const uint8_t *srcData, uint8_t *outData, const FileOperation &operation) const;
 
-			int bzipWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) const;
+			int bzipWrite(const uint8_t *srcData, uint8_t *outData, const FileOperation &operation) const;
 
-			static int zeroWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation);
+			/**
+			 * Zeroes the dst extents without writing data: extents that are holes already are skipped,
+			 * the others punched (or zero ranged) in the output file. Zeroed through the mapping where
+			 * that fails (no outFd, no fallocate, filesystem support).
+			 */
+			static int zeroWrite(uint8_t *outData, int outFd, const FileOperation &operation);
 
-			int xzWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) const;
+			int xzWrite(const uint8_t *srcData, uint8_t *outData, const FileOperation &operation) const;
 
-			int zstdWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) const;
+			int zstdWrite(const uint8_t *srcData, uint8_t *outData, const FileOperation &operation) const;
 
 			static int extentsRead(const uint8_t *inData, uint8_t *data, const std::vector<Extent> &extents);
 
@@ -37,11 +64,56 @@ namespace skkk {
 
 			static int sourceCopy(const uint8_t *inData, uint8_t *outData, const FileOperation &operation);
 
-			int brotliBSDiff(const uint8_t *payloadData, const uint8_t *inData, uint8_t *outData,
-			                 const FileOperation &operation) const;
-
-			int writeDataByType(const uint8_t *payloadData, const uint8_t *inData, uint8_t *outData,
+			/**
+			 * Source data of the operation, viewed in place when the src extents are contiguous,
+			 * otherwise gathered into buffer. nullptr on failure.
+			 */
+			static const uint8_t *sourceData(const uint8_t *inData, const FileOperation &operation,
+			                                 Buffer<uint8_t> &buffer);
+
+			/**
+			 * BSDIFF, SOURCE_BSDIFF (BSDIFF40, bzip2) and BROTLI_BSDIFF (BSDF2).
+			 */
+			static int bsDiff(const uint8_t *patchData, const uint8_t *inData, uint8_t *outData,
+			                  const FileOperation &operation);
+
+			/**
+			 * Applies patch to the source data into the dst extents, through a buffer
+			 * when they aren't contiguous.
+			 */
+			static int patchWrite(const patchPtr &patch, const uint8_t *patchData, const uint8_t *inData,
+			                      uint8_t *outData, const FileOperation &operation);
+
+			/**
+			 * bsdiff over the src and dst data with their deflate streams puffed (puffin).
+			 */
+			static int puffDiff(const uint8_t *patchData, const uint8_t *inData, uint8_t *outData,
+			                    const FileOperation &operation);
+
+			/**
+			 * Zucchini patch of the src data, brotli compressed.
+			 */
+			static int zucchiniDiff(const uint8_t *patchData, const uint8_t *inData, uint8_t *outData,
+			                        const FileOperation &operation);
+
+			/**
+			 * bsdiff or puffdiff over the lz4 blocks of src and dst decompressed (EROFS),
+			 * the patched data is compressed again into the dst blocks.
+			 */
+			static int lz4Diff(const uint8_t *patchData, const uint8_t *inData, uint8_t *outData,
+			                   const FileOperation &operation);
+
+			/**
+			 * outFd: the file outData maps, -1 if there is none.
+			 */
+			int writeDataByType(const uint8_t *payloadData, const uint8_t *inData, uint8_t *outData, int outFd,
 			                    const FileOperation &operation) const;
+
+			/**
+			 * Same as writeDataByType, with the payload data of the operation already read.
+			 */
+			int writeOperation(const uint8_t *operationData, const uint8_t *inData, uint8_t *outData, int outFd,
+			                   const FileOperation &operation) const;
 	};
 }
 
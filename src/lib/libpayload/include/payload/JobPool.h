@@ -0,0 +1,139 @@
+#ifndef PAYLOAD_EXTRACT_JOBPOOL_H
+#define PAYLOAD_EXTRACT_JOBPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "MemoryBudget.h"
+#include "common/TaskLimiter.h"
+#include "common/threadpool.h"
+
+namespace skkk {
+	/**
+	 * The pool as one job (payload) may use it: the task limit (--job-threads) and the memory
+	 * budget (--max-memory) of the job apply to every task it commits, including the helper
+	 * tasks that decode the blocks of a large operation.
+	 * Helper tasks may start after their operation is done, the destructor waits for them.
+	 */
+	class JobPool {
+		std::threadpool &pool;
+		// nullptr: unlimited
+		std::shared_ptr<TaskLimiter> taskLimiter;
+		MemoryBudget *memoryBudget;
+		// Helper tasks not yet done, outlives the pool for the last notify
+		std::shared_ptr<std::atomic_uint64_t> helperCount = std::make_shared<std::atomic_uint64_t>(0);
+
+		public:
+			explicit JobPool(std::threadpool &pool, const std::shared_ptr<TaskLimiter> &taskLimiter = nullptr,
+			                 MemoryBudget *memoryBudget = nullptr)
+				: pool(pool), taskLimiter(taskLimiter), memoryBudget(memoryBudget) {
+			}
+
+			~JobPool() {
+				for (uint64_t count; (count = *helperCount) > 0;) {
+					helperCount->wait(count);
+				}
+			}
+
+			JobPool(const JobPool &) = delete;
+
+			JobPool &operator=(const JobPool &) = delete;
+
+			/**
+			 * Threads the job runs on at most
+			 */
+			uint32_t thrCount() const {
+				const auto size = static_cast<uint32_t>(std::max(pool.thrCount(), 1));
+				return taskLimiter ? std::min(size, taskLimiter->getLimit()) : size;
+			}
+
+			/**
+			 * Idle workers the job may take now
+			 */
+			uint32_t idlCount() const {
+				const auto idle = static_cast<uint32_t>(std::max(pool.idlCount(), 0));
+				return taskLimiter ? std::min(idle, taskLimiter->available()) : idle;
+			}
+
+			template<class F>
+			void commit(F &&task) {
+				if (taskLimiter) {
+					taskLimiter->commit(std::forward<F>(task));
+				} else {
+					pool.commit2(std::forward<F>(task));
+				}
+			}
+
+			/**
+			 * Chunk size of a range of size indexes, about eight chunks per thread the job runs on
+			 */
+			uint64_t rangeGrain(uint64_t size) const {
+				return std::max<uint64_t>(1, size / (thrCount() * 8ULL));
+			}
+
+			/**
+			 * Same as std::threadpool::commitRange within the limits of the job: one task per chunk,
+			 * f(begin, end). grain 0: rangeGrain.
+			 */
+			template<class F>
+			void commitRange(uint64_t begin, uint64_t end, uint64_t grain, F &&f) {
+				if (begin >= end) return;
+				if (grain == 0) grain = rangeGrain(end - begin);
+				auto fn = std::make_shared<std::decay_t<F> >(std::forward<F>(f));
+				for (uint64_t b = begin; b < end; b += grain) {
+					const uint64_t e = std::min(end, b + grain);
+					commit([fn, b, e] {
+						(*fn)(b, e);
+					});
+				}
+			}
+
+			/**
+			 * Same as commit, the task goes to the queue of worker
+			 */
+			template<class F>
+			void commitTo(uint32_t worker, F &&task) {
+				if (taskLimiter) {
+					taskLimiter->commitTo(worker, std::forward<F>(task));
+				} else {
+					pool.commitTo(worker, std::forward<F>(task));
+				}
+			}
+
+			/**
+			 * Reserves size of the memory budget without waiting, false if it has no room now
+			 */
+			bool tryReserve(uint64_t size) {
+				return !memoryBudget || memoryBudget->tryAcquire(size);
+			}
+
+			void release(uint64_t size) {
+				if (memoryBudget) memoryBudget->release(size);
+			}
+
+			/**
+			 * Commits up to num helper tasks, each holds helperSize of the memory budget until it is done.
+			 * Stops at the first helper the budget has no room for, returns the number committed.
+			 */
+			uint64_t commitHelpers(uint64_t num, uint64_t helperSize, const std::function<void()> &task) {
+				uint64_t i = 0;
+				for (; i < num; i++) {
+					if (memoryBudget && !memoryBudget->tryAcquire(helperSize)) break;
+					++*helperCount;
+					commit([task, budget = memoryBudget, helperSize, count = helperCount] {
+						task();
+						if (budget) budget->release(helperSize);
+						if (--*count == 0) count->notify_all();
+					});
+				}
+				return i;
+			}
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_JOBPOOL_H
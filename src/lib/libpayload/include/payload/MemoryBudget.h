@@ -0,0 +1,82 @@
+#ifndef PAYLOAD_EXTRACT_MEMORYBUDGET_H
+#define PAYLOAD_EXTRACT_MEMORYBUDGET_H
+
+#include <cinttypes>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include "PartitionInfo.h"
+
+namespace skkk {
+	/**
+	 * Admission control for in-flight operations: an operation only starts once its
+	 * estimated scratch memory fits into the budget, otherwise the worker waits.
+	 * An operation larger than the whole budget runs alone.
+	 */
+	class MemoryBudget {
+		const uint64_t limit;
+		const bool isUrl;
+		uint64_t used = 0;
+		uint64_t peak = 0;
+		uint64_t waitCount = 0;
+		std::mutex mutex;
+		std::condition_variable cv;
+
+		public:
+			MemoryBudget(uint64_t limit, bool isUrl);
+
+			/**
+			 * Estimated heap footprint of one operation: payload data copied from the
+			 * network, source gather buffers, destination buffers and decoder state.
+			 */
+			uint64_t estimate(const FileOperation &operation) const;
+
+			/**
+			 * Estimated heap footprint of one helper task decoding blocks of the operation
+			 * in parallel: its decoder state and the copy of the block it decodes.
+			 */
+			static uint64_t helperEstimate(const FileOperation &operation);
+
+			void acquire(uint64_t size);
+
+			/**
+			 * Same as acquire without waiting, false if the size does not fit now.
+			 */
+			bool tryAcquire(uint64_t size);
+
+			void release(uint64_t size);
+
+			uint64_t getLimit() const { return limit; }
+
+			std::string summary();
+
+			/**
+			 * "512M", "2G", "1048576"
+			 */
+			static bool parseSize(const std::string &str, uint64_t &size);
+
+			static std::string formatSize(uint64_t size);
+	};
+
+	class MemoryBudgetGuard {
+		MemoryBudget *budget;
+		uint64_t size;
+
+		public:
+			MemoryBudgetGuard(MemoryBudget *budget, const FileOperation &operation)
+				: budget(budget), size(budget ? budget->estimate(operation) : 0) {
+				if (budget) budget->acquire(size);
+			}
+
+			~MemoryBudgetGuard() {
+				if (budget) budget->release(size);
+			}
+
+			MemoryBudgetGuard(const MemoryBudgetGuard &) = delete;
+
+			MemoryBudgetGuard &operator=(const MemoryBudgetGuard &) = delete;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_MEMORYBUDGET_H
@@ -0,0 +1,43 @@
+#ifndef PAYLOAD_EXTRACT_OPERATIONCOSTMODEL_H
+#define PAYLOAD_EXTRACT_OPERATIONCOSTMODEL_H
+
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "PartitionInfo.h"
+
+namespace skkk {
+	/**
+	 * Estimates the run time of an operation as:
+	 *     nsPerByte[type] * (dataWeight[type] * dataLength + dstTotalLength)
+	 * The shape (dataWeight) is fixed, nsPerByte can be calibrated from a previous run.
+	 */
+	class OperationCostModel {
+		static constexpr uint32_t TYPE_SIZE = 16;
+
+		std::array<double, TYPE_SIZE> dataWeight{};
+		std::array<double, TYPE_SIZE> nsPerByte{};
+		mutable std::array<std::atomic_uint64_t, TYPE_SIZE> recordedNs{};
+		mutable std::array<std::atomic_uint64_t, TYPE_SIZE> recordedBytes{};
+
+		uint64_t weightedBytes(const FileOperation &operation) const;
+
+		public:
+			OperationCostModel();
+
+			uint64_t estimate(const FileOperation &operation) const;
+
+			void record(const FileOperation &operation, uint64_t ns) const;
+
+			std::vector<const FileOperation *> sortByCost(const std::vector<FileOperation> &operations) const;
+
+			bool loadProfile(const std::string &path);
+
+			bool saveProfile(const std::string &path) const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_OPERATIONCOSTMODEL_H
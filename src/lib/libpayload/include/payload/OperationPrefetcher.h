@@ -0,0 +1,65 @@
+#ifndef PAYLOAD_EXTRACT_OPERATIONPREFETCHER_H
+#define PAYLOAD_EXTRACT_OPERATIONPREFETCHER_H
+
+#include <algorithm>
+#include <cinttypes>
+#include <memory>
+#include <semaphore>
+
+#include "FileWriter.h"
+#include "MemoryBudget.h"
+#include "PartitionInfo.h"
+#include "common/Buffer.hpp"
+#include "common/threadpool.h"
+
+namespace skkk {
+	/**
+	 * URL mode pipeline: download -> decode -> write.
+	 * The payload data of an operation is downloaded by a fetch thread, then the operation is
+	 * committed to the decode pool with its data. At most queueSize downloaded operations wait
+	 * for a decode thread, so the network and all cores are busy at the same time
+	 * without buffering the whole payload.
+	 * With a memory budget the estimate of an operation is reserved before its download
+	 * and released once it is decoded, the downloaded data counts against the budget as well.
+	 * Operations without payload data take the same path, only their budget is reserved.
+	 */
+	class OperationPrefetcher {
+		const FileWriter &fileWriter;
+		// nullptr: unlimited
+		MemoryBudget *memoryBudget;
+		// Downloaded operations not yet taken by a decode thread
+		std::counting_semaphore<> slots;
+		std::threadpool fetchPool;
+
+		public:
+			OperationPrefetcher(const FileWriter &fileWriter, MemoryBudget *memoryBudget, uint32_t fetchThreadNum,
+			                    uint32_t queueSize)
+				: fileWriter(fileWriter), memoryBudget(memoryBudget), slots(std::max(queueSize, 1U)),
+				  fetchPool(fetchThreadNum) {
+			}
+
+			/**
+			 * onFetched(const uint8_t *operationData) runs on the decode pool,
+			 * commitDecode(task) commits a task to it and must outlive the fetch.
+			 * onFetched must not take the memory budget of the operation again.
+			 */
+			template<class C, class F>
+			void fetch(C &commitDecode, const FileOperation &operation, F &&onFetched) {
+				fetchPool.commit2([this, &commitDecode, &operation, onFetched = std::forward<F>(onFetched)] {
+					slots.acquire();
+					const uint64_t budgetSize = memoryBudget ? memoryBudget->estimate(operation) : 0;
+					if (memoryBudget) memoryBudget->acquire(budgetSize);
+					auto buffer = std::make_shared<Buffer<uint8_t> >();
+					const uint8_t *operationData = fileWriter.readOperationData(nullptr, operation, *buffer);
+					commitDecode([this, buffer, operationData, onFetched, budgetSize]() mutable {
+						slots.release();
+						onFetched(operationData);
+						buffer.reset();
+						if (memoryBudget) memoryBudget->release(budgetSize);
+					});
+				});
+			}
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_OPERATIONPREFETCHER_H
@@ -1,37 +1,57 @@
 #ifndef PAYLOAD_EXTRACT_PARTITIONWRITER_H
 #define PAYLOAD_EXTRACT_PARTITIONWRITER_H
 
+#include <atomic>
+#include <functional>
+#include <latch>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include "FileWriter.h"
+#include "MemoryBudget.h"
+#include "OperationCostModel.h"
+#include "OperationPrefetcher.h"
 #include "PayloadInfo.h"
+#include "ShardManifest.h"
+#include "SparseImage.h"
+#include "ThreadTuner.h"
+#include "common/TaskLimiter.h"
+#include "common/threadpool.h"
 #include "verify/VerifyWriter.h"
 
 namespace skkk {
-	class PartitionWriteContext {
+	/**
+	 * Called once all operations of a partition are written and its files are closed,
+	 * from the thread that finished the partition.
+	 */
+	using PartitionDoneCallback = std::function<void(const PartitionInfo &info, bool isSuccessful)>;
+
+	class PartitionExtractContext {
 		public:
 			const PartitionInfo &partitionInfo;
-			const FileWriter &fileWriter;
-			const FileOperation &operation;
-			const uint8_t *payloadData;
-			const uint8_t *inData;
-			uint8_t *outData;
-			const bool isIncremental;
+			int inFd = -1;
+			int outFd = -1;
+			uint64_t inDataSize = 0;
+			const uint8_t *inData = nullptr;
+			uint64_t outDataSize = 0;
+			uint8_t *outData = nullptr;
+			const OperationCostModel *costModel = nullptr;
+			ThreadTuner *threadTuner = nullptr;
+			MemoryBudget *memoryBudget = nullptr;
+			const PartitionDoneCallback *partitionDoneCallback = nullptr;
+			std::vector<const FileOperation *> operations;
+			// Operations not yet finished, the last one releases the files
+			std::atomic_uint64_t pendingSize = 0;
+			bool isSubmitted = false;
+			std::latch done{1};
 
 		public:
-			PartitionWriteContext(const PartitionInfo &partitionInfo, const FileWriter &fileWriter,
-			                      const FileOperation &operation, const uint8_t *payloadData, const uint8_t *inData,
-			                      uint8_t *outData, bool isIncremental)
-				: partitionInfo(partitionInfo),
-				  fileWriter(fileWriter),
-				  operation(operation),
-				  payloadData(payloadData),
-				  inData(inData),
-				  outData(outData),
-				  isIncremental(isIncremental) {
+			explicit PartitionExtractContext(const PartitionInfo &partitionInfo)
+				: partitionInfo(partitionInfo) {
 			}
 	};
 
@@ -41,19 +61,50 @@ namespace skkk {
 		const ExtractConfig &config;
 		std::vector<PartitionInfo> partitions;
 		std::shared_ptr<VerifyWriter> verifyWriter;
+		std::shared_ptr<OperationCostModel> costModel;
+		std::shared_ptr<std::threadpool> threadPool;
+		PartitionDoneCallback partitionDoneCallback;
+		std::unordered_set<const FileOperation *> shardOperations;
+		// partition -> sparse layout, only in sparse output mode
+		std::map<std::string, SparseImage> sparseImages;
+
+		std::vector<const FileOperation *> getScheduledOperations(const PartitionInfo &info) const;
+
+		void sortByPriority();
+
+		void selectShardOperations();
+
+		bool isShardMode() const { return config.shardCount > 1; }
+
+		bool isInShard(const FileOperation &operation) const {
+			return !isShardMode() || shardOperations.contains(&operation);
+		}
+
+		bool writeShardManifest() const;
+
+		/**
+		 * In sparse output mode the dst extents of the operations are translated
+		 * to the data offsets in the sparse files.
+		 */
+		bool initSparseImages();
+
+		const SparseImage *getSparseImage(const PartitionInfo &info) const;
 
 		public:
-			explicit PartitionWriter(const std::shared_ptr<PayloadInfo> &payloadInfo);
+			PartitionWriter(const std::shared_ptr<PayloadInfo> &payloadInfo,
+			                const std::shared_ptr<std::threadpool> &threadPool);
 
 			bool initPartitions();
 
 			bool initPartitionsByTarget();
 
+			void setPartitionDoneCallback(const PartitionDoneCallback &callback);
+
 			void printPartitionsInfo() const;
 
 			bool createOutDir() const;
 
-			static int createOutFile(const std::string &path, uint64_t fileSize);
+			static int createOutFile(const std::string &path, uint64_t fileSize, bool isTruncate = true);
 
 			static int initInFd(const std::string &path);
 
@@ -69,7 +120,15 @@ namespace skkk {
 
 			bool extractPartitionByName(const std::string &name);
 
+			void extractPartitionsMT() const;
+
 			void extractPartitions() const;
+
+			/**
+			 * Copy the extents of every shard into the output files (if a shard wrote elsewhere)
+			 * and verify that every dst extent was written by exactly one shard.
+			 */
+			bool mergeShards(const std::vector<std::string> &manifestPaths) const;
 	};
 }
 
@@ -7,4 +7,9 @@ enum PayloadType {
 	PAYLOAD_TYPE_URL,
 };
 
+enum ScheduleMode {
+	SCHEDULE_MANIFEST = 0,
+	SCHEDULE_LPT,
+};
+
 #endif //PAYLOAD_EXTRACT_PAYLOADDEFS_H
@@ -8,6 +8,7 @@
 #include "ExtractConfig.h"
 #include "PartitionWriter.h"
 #include "PayloadInfo.h"
+#include "common/threadpool.h"
 
 namespace skkk {
 	class PayloadParser {
@@ -15,6 +16,7 @@ namespace skkk {
 		std::atomic_bool initialized = false;
 		std::shared_ptr<PayloadInfo> payloadInfo;
 		std::shared_ptr<PartitionWriter> partitionWriter;
+		std::shared_ptr<std::threadpool> threadPool;
 
 		public:
 			PayloadParser() = default;
@@ -27,8 +29,20 @@ namespace skkk {
 
 			PayloadParser &operator=(PayloadParser &&other) = delete;
 
+			/**
+			 * Use an existing pool instead of creating one in parse(), must be called before parse().
+			 */
+			void setThreadPool(const std::shared_ptr<std::threadpool> &pool);
+
 			bool parse(const ExtractConfig &config);
 
+			/**
+			 * The pool parse() creates: config.threadNum workers, pinned to config.cpuSet.
+			 */
+			static std::shared_ptr<std::threadpool> createThreadPool(const ExtractConfig &config);
+
+			std::shared_ptr<std::threadpool> getThreadPool();
+
 			std::shared_ptr<PayloadInfo> getPayloadInfo();
 
 			std::shared_ptr<PartitionWriter> getPartitionWriter();
@@ -0,0 +1,45 @@
+#ifndef PAYLOAD_EXTRACT_SHARDMANIFEST_H
+#define PAYLOAD_EXTRACT_SHARDMANIFEST_H
+
+#include <cinttypes>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "PartitionInfo.h"
+
+namespace skkk {
+	/**
+	 * The extents one shard (--shard i/n) has written, one line each:
+	 *     shard:<index>:<count>
+	 *     file:<partition>:<output path>
+	 *     extent:<partition>:<offset>:<length>
+	 */
+	class ShardManifest {
+		public:
+			uint32_t shardIndex = 0;
+			uint32_t shardCount = 0;
+			// partition -> output file of the shard
+			std::map<std::string, std::string> files;
+			// partition -> [offset, length]
+			std::map<std::string, std::vector<std::pair<uint64_t, uint64_t>>> extents;
+
+		public:
+			/**
+			 * Deterministic for the same payload and partitions, independent of the partition order:
+			 * operations by descending dst bytes, each to the shard with the fewest bytes so far.
+			 */
+			static std::unordered_set<const FileOperation *> selectOperations(
+				const std::vector<PartitionInfo> &partitions, uint32_t shardIndex, uint32_t shardCount);
+
+			static std::string getManifestPath(const std::string &outDir, uint32_t shardIndex, uint32_t shardCount);
+
+			bool load(const std::string &path);
+
+			bool save(const std::string &path) const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_SHARDMANIFEST_H
@@ -0,0 +1,63 @@
+#ifndef PAYLOAD_EXTRACT_SPARSEIMAGE_H
+#define PAYLOAD_EXTRACT_SPARSEIMAGE_H
+
+#include <cinttypes>
+#include <vector>
+
+#include "PartitionInfo.h"
+
+namespace skkk {
+	enum SparseChunkType {
+		SPARSE_CHUNK_RAW = 0xCAC1,
+		SPARSE_CHUNK_FILL = 0xCAC2,
+		SPARSE_CHUNK_DONT_CARE = 0xCAC3,
+	};
+
+	class SparseChunk {
+		public:
+			uint16_t type = SPARSE_CHUNK_DONT_CARE;
+			uint64_t startBlock = 0;
+			uint64_t numBlocks = 0;
+			// Offset of the chunk header in the sparse file, the data follows it
+			uint64_t fileOffset = 0;
+	};
+
+	/**
+	 * Android sparse image (img2simg) layout of a partition, built from the dst extents
+	 * of its operations: written blocks become RAW chunks, ZERO blocks a zero FILL chunk,
+	 * DISCARD blocks and blocks no operation writes DONT_CARE chunks.
+	 * The RAW chunk data is written in place, so there is no raw image in between.
+	 */
+	class SparseImage {
+		public:
+			static constexpr uint32_t SPARSE_HEADER_MAGIC = 0xED26FF3A;
+			static constexpr uint32_t FILE_HEADER_SIZE = 28;
+			static constexpr uint32_t CHUNK_HEADER_SIZE = 12;
+
+			uint32_t blockSize = 0;
+			uint64_t totalBlocks = 0;
+			std::vector<SparseChunk> chunks;
+			uint64_t fileSize = 0;
+
+		public:
+			/**
+			 * false if the partition size is not block aligned, or dst extents overlap
+			 * or lie past the end of the partition.
+			 */
+			bool init(const PartitionInfo &info);
+
+			/**
+			 * Points the dst extents of the operation at the data of its RAW chunks,
+			 * extents crossing a chunk boundary are split. ZERO and DISCARD operations
+			 * are left without dst extents, their chunks need no data.
+			 */
+			void translate(FileOperation &operation) const;
+
+			/**
+			 * The file header and every chunk header, outData maps at least fileSize bytes.
+			 */
+			void writeHeaders(uint8_t *outData) const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_SPARSEIMAGE_H
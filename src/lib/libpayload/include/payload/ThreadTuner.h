@@ -0,0 +1,58 @@
+#ifndef PAYLOAD_EXTRACT_THREADTUNER_H
+#define PAYLOAD_EXTRACT_THREADTUNER_H
+
+#include <atomic>
+#include <cinttypes>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common/threadpool.h"
+
+namespace skkk {
+	/**
+	 * Adjusts the number of active pool workers from the measured throughput (hill climbing).
+	 * If the workers use much less cpu time than wall time the run is I/O bound (URL mode,
+	 * slow disks) and may use the whole pool, otherwise it is decode bound and stays
+	 * within the available cpus.
+	 */
+	class ThreadTuner {
+		static constexpr uint32_t INTERVAL_MS = 500;
+		// cpu time / (wall time * active workers) below this is I/O bound
+		static constexpr double IO_BOUND_UTILIZATION = 0.6;
+
+		std::threadpool &threadPool;
+		const uint32_t cpuLimit;
+		// Active workers before tuning, restored by stop()
+		const uint32_t initialActive;
+		std::atomic_uint64_t doneBytes = 0;
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool isStop = false;
+		std::thread thread;
+
+		uint32_t minActive = 0;
+		uint32_t maxActive = 0;
+		uint32_t samples = 0;
+		uint32_t ioBoundSamples = 0;
+
+		void run();
+
+		public:
+			ThreadTuner(std::threadpool &threadPool, uint32_t cpuLimit);
+
+			~ThreadTuner();
+
+			void addBytes(uint64_t size) { doneBytes += size; }
+
+			/**
+			 * Stop tuning and give the pool back the active workers it had before.
+			 */
+			void stop();
+
+			std::string summary() const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_THREADTUNER_H
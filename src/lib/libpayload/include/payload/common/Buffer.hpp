@@ -2,17 +2,53 @@
 #define PAYLOAD_EXTRACT_BUFFER_H
 
 #include <algorithm>
+#include <atomic>
 #include <memory>
 
 namespace skkk {
+	/**
+	 * Bytes currently held by all Buffers and the highest value seen.
+	 */
+	class BufferStats {
+		inline static std::atomic_uint64_t used = 0;
+		inline static std::atomic_uint64_t peak = 0;
+
+		public:
+			static void add(uint64_t size) {
+				const uint64_t current = used += size;
+				uint64_t last = peak.load(std::memory_order_relaxed);
+				while (current > last && !peak.compare_exchange_weak(last, current, std::memory_order_relaxed)) {
+				}
+			}
+
+			static void sub(uint64_t size) {
+				used -= size;
+			}
+
+			static uint64_t getUsed() { return used; }
+
+			static uint64_t getPeak() { return peak; }
+	};
+
 	template<typename T>
 	class Buffer {
 		uint64_t size_ = 0;
 		std::unique_ptr<T[]> data_{};
 
+		void free() {
+			if (data_) {
+				data_.reset();
+				BufferStats::sub(size_ * sizeof(T));
+			}
+			size_ = 0;
+		}
+
 		void allocate(uint64_t size) {
+			free();
+			// Not value initialized, the callers overwrite it or use setValue()
+			this->data_ = std::make_unique_for_overwrite<T[]>(size);
 			this->size_ = size;
-			this->data_ = std::make_unique<T[]>(size);
+			BufferStats::add(size * sizeof(T));
 		}
 
 		void setValue(T value) {
@@ -41,9 +77,14 @@ namespace skkk {
 				other.size_ = 0;
 			}
 
+			~Buffer() {
+				free();
+			}
+
 			Buffer &operator=(Buffer &&other) noexcept {
 				if (this == &other)
 					return *this;
+				free();
 				size_ = other.size_;
 				data_ = std::move(other.data_);
 				other.size_ = 0;
@@ -79,6 +120,10 @@ namespace skkk {
 			T *get() {
 				return data_.get();
 			}
+
+			uint64_t size() const {
+				return size_;
+			}
 	};
 }
 
@@ -0,0 +1,61 @@
+#ifndef PAYLOAD_EXTRACT_CPUTOPOLOGY_H
+#define PAYLOAD_EXTRACT_CPUTOPOLOGY_H
+
+#include <cinttypes>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace skkk {
+	class CpuTopology {
+		public:
+			std::vector<uint32_t> onlineCpus;
+			// Online cpus in the affinity mask (cpuset) of the process
+			std::vector<uint32_t> allowedCpus;
+			// numa node -> cpus
+			std::map<uint32_t, std::vector<uint32_t>> nodeCpus;
+
+		public:
+			CpuTopology();
+
+			uint32_t nodeOfCpu(uint32_t cpu) const;
+
+			/**
+			 * Cpus this process may really use: the affinity mask (cpuset)
+			 * limited by the cgroup v1/v2 cpu quota, at least 1.
+			 */
+			static uint32_t availableCpus();
+
+			/**
+			 * Cpu quota of the cgroup (rounded up), 0: no quota.
+			 */
+			static uint32_t cgroupCpuQuota();
+
+			/**
+			 * Cpu of every worker, worker i runs on cpus[i % cpus.size()].
+			 */
+			static std::vector<uint32_t> workerCpus(const std::vector<uint32_t> &cpus, uint32_t threadNum);
+
+			/**
+			 * numa node -> workers
+			 */
+			std::map<uint32_t, std::vector<uint32_t>> workersByNode(const std::vector<uint32_t> &cpus,
+			                                                         uint32_t threadNum) const;
+
+			/**
+			 * numa node of every worker
+			 */
+			std::vector<uint32_t> workerNodes(const std::vector<uint32_t> &cpus, uint32_t threadNum) const;
+
+			std::string describe(const std::vector<uint32_t> &cpus, uint32_t threadNum) const;
+
+			/**
+			 * Linux cpu list format: "0-3,8,10-11"
+			 */
+			static bool parseCpuList(const std::string &str, std::vector<uint32_t> &cpus);
+
+			static std::string formatCpuList(const std::vector<uint32_t> &cpus);
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_CPUTOPOLOGY_H
@@ -0,0 +1,100 @@
+#ifndef PAYLOAD_EXTRACT_TASKLIMITER_H
+#define PAYLOAD_EXTRACT_TASKLIMITER_H
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "threadpool.h"
+
+namespace skkk {
+	/**
+	 * Runs at most limit tasks of one owner on a shared pool at the same time,
+	 * the others are queued here and committed once a running task of the owner finishes.
+	 * Tasks keep the limiter alive, it must be created by std::make_shared.
+	 */
+	class TaskLimiter : public std::enable_shared_from_this<TaskLimiter> {
+		// Any worker may run the task
+		static constexpr uint32_t ANY_WORKER = UINT32_MAX;
+
+		class PendingTask {
+			public:
+				std::function<void()> task;
+				uint32_t worker = ANY_WORKER;
+		};
+
+		std::threadpool &pool;
+		const uint32_t limit;
+		uint32_t running = 0;
+		std::deque<PendingTask> pending;
+		std::mutex mutex;
+
+		void run(std::function<void()> task, uint32_t worker) {
+			auto wrapped = [self = shared_from_this(), task = std::move(task)] {
+				task();
+				std::unique_lock lock{self->mutex};
+				if (self->pending.empty()) {
+					self->running--;
+					return;
+				}
+				auto next = std::move(self->pending.front());
+				self->pending.pop_front();
+				lock.unlock();
+				self->run(std::move(next.task), next.worker);
+			};
+			if (worker == ANY_WORKER) {
+				pool.commit2(std::move(wrapped));
+			} else {
+				pool.commitTo(worker, std::move(wrapped));
+			}
+		}
+
+		template<class F>
+		void enqueue(F &&task, uint32_t worker) {
+			{
+				std::lock_guard lock{mutex};
+				if (running >= limit) {
+					pending.emplace_back(std::function<void()>{std::forward<F>(task)}, worker);
+					return;
+				}
+				running++;
+			}
+			run(std::function<void()>{std::forward<F>(task)}, worker);
+		}
+
+		public:
+			TaskLimiter(std::threadpool &pool, uint32_t limit)
+				: pool(pool), limit(std::max(limit, 1U)) {
+			}
+
+			template<class F>
+			void commit(F &&task) {
+				enqueue(std::forward<F>(task), ANY_WORKER);
+			}
+
+			/**
+			 * Same as commit, the task goes to the queue of worker once it may start
+			 */
+			template<class F>
+			void commitTo(uint32_t worker, F &&task) {
+				enqueue(std::forward<F>(task), worker);
+			}
+
+			uint32_t getLimit() const { return limit; }
+
+			/**
+			 * Tasks that may start now without being queued
+			 */
+			uint32_t available() {
+				std::lock_guard lock{mutex};
+				return limit - running;
+			}
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_TASKLIMITER_H
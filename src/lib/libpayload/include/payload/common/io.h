@@ -23,6 +23,10 @@ namespace skkk {
 
 	int blobFallocate(int fd, off64_t offset, off64_t length);
 
+	int blobPunchHole(int fd, off64_t offset, off64_t length);
+
+	bool blobIsHole(int fd, off64_t offset, off64_t length);
+
 	bool readToString(const std::string &filePath, std::string &result);
 
 	bool readAllLines(const std::string &filePath, std::vector<std::string> &result);
@@ -0,0 +1,351 @@
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cinttypes>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <latch>
+#include <memory>
+#include <stdexcept>
+
+#ifdef _WIN32 // windows
+#else // linux
+#include <condition_variable>
+#include <thread>
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+/**
+ * based on C++11 , a mini threadpool , accept variable number of parameters 基于C++11的线程池,简洁且可以带任意多的参数
+ * https://github.com/lzpong/threadpool
+ *
+ * Every worker owns a task queue, idle workers steal from the others,
+ * from the workers of their own group (numa node) first.
+ * Workers spin for a while before they park on an atomic (futex on linux).
+ * Only the first activeCount() workers run tasks, the others wait until the limit is raised.
+ */
+namespace std {
+	//线程池最大容量,应尽量设小一点
+#define THREADPOOL_MAX_NUM thread::hardware_concurrency() * 2
+	// Number of empty polls before a worker parks
+#ifndef THREADPOOL_SPIN_COUNT
+#define THREADPOOL_SPIN_COUNT 4096
+#endif
+
+	//线程池,可以提交变参函数或拉姆达表达式的匿名函数执行,可以获取执行返回值
+	//不直接支持类成员函数, 支持类静态成员函数或全局函数,Opteron()函数等
+	class threadpool {
+		using Task = function<void()>; //定义类型
+
+		struct WorkQueue {
+			mutex lock;
+			deque<Task> tasks;
+		};
+
+		uint32_t _initSize; //初始化线程数量
+		vector<thread> _pool; //线程池
+		vector<unique_ptr<WorkQueue>> _queues; // 每个线程一个任务队列
+		vector<uint32_t> _cpus; // 线程 i 绑定到 _cpus[i % size]
+		vector<uint32_t> _groups; // 线程 i 所在的组 _groups[i % size], 为空时不分组
+		vector<vector<uint32_t>> _stealOrder; // 线程 i 取任务的队列顺序: 自己, 同组, 其他
+		atomic<uint32_t> _next{0}; // 外部提交时轮询的队列
+		atomic<int64_t> _pending{0}; // 队列中的任务数量
+		atomic<uint32_t> _sleeping{0}; // 休眠中的线程数量
+		atomic<uint32_t> _epoch{0}; // 唤醒信号
+		atomic<uint32_t> _active{0}; // 参与执行的线程数量
+		atomic<bool> _run{true}; //线程池是否执行
+		atomic<int> _idlThrNum{0}; //空闲线程数量
+
+		inline static thread_local threadpool *_currentPool = nullptr;
+		inline static thread_local uint32_t _currentIndex = 0;
+
+		public:
+			inline threadpool(uint32_t size = 1) {
+				_initSize = size;
+				addThread(size);
+			}
+
+			// 每个线程绑定到一个 cpu (仅 linux/android)
+			inline threadpool(uint32_t size, const vector<uint32_t> &cpus) : _cpus(cpus) {
+				_initSize = size;
+				addThread(size);
+			}
+
+			// 同上, 空闲线程先窃取同组 (同一 numa 节点) 线程的任务, 同组没有任务时才窃取其他组的
+			inline threadpool(uint32_t size, const vector<uint32_t> &cpus, const vector<uint32_t> &groups)
+				: _cpus(cpus), _groups(groups) {
+				_initSize = size;
+				addThread(size);
+			}
+
+			inline ~threadpool() {
+				_run = false;
+				++_epoch;
+				_epoch.notify_all(); // 唤醒所有线程执行
+				_active = _pool.size() + 1;
+				_active.notify_all();
+				for (thread &thread: _pool) {
+					//thread.detach(); // 让线程“自生自灭”
+					if (thread.joinable())
+						thread.join(); // 等待任务结束， 前提：线程一定会执行完
+				}
+			}
+
+		public:
+			// 提交一个任务
+			// 调用.get()获取返回值会等待任务执行完,获取返回值
+			// 有两种方法可以实现调用类成员，
+			// 一种是使用   bind： .commit(std::bind(&Dog::sayHello, &dog));
+			// 一种是用   mem_fn： .commit(std::mem_fn(&Dog::sayHello), this)
+			template<class F, class... Args>
+			auto commit(F &&f, Args &&... args) -> future<decltype(f(args...))> {
+				if (!_run) // stoped ??
+					throw std::runtime_error("commit on ThreadPool is stopped.");
+
+				using RetType = decltype(f(args...)); // typename std::result_of<F(Args...)>::type, 函数 f 的返回值类型
+				auto task = make_shared<packaged_task<RetType()> >(
+					std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+				); // 把函数入口及参数,打包(绑定)
+				future<RetType> future = task->get_future();
+				push([task]() {
+					(*task)();
+				});
+				return future;
+			}
+
+			// 提交一个无参任务, 且无返回值
+			template<class F>
+			void commit2(F &&task) {
+				if (!_run) return;
+				push(Task{std::forward<F>(task)});
+			}
+
+			// 提交到指定线程的队列, 其他空闲线程仍可窃取 (同组优先)
+			template<class F>
+			void commitTo(uint32_t worker, F &&task) {
+				if (!_run) return;
+				push(Task{std::forward<F>(task)}, worker % _queues.size());
+			}
+
+			// 按区间分块提交, 每块一个任务: f(begin, end), 块可被空闲线程窃取
+			// grain 为 0 时按线程数自动分块
+			template<class F>
+			void commitRange(uint64_t begin, uint64_t end, uint64_t grain, F &&f) {
+				if (begin >= end) return;
+				grain = rangeGrain(end - begin, grain);
+				auto fn = make_shared<decay_t<F> >(std::forward<F>(f));
+				for (uint64_t b = begin; b < end; b += grain) {
+					const uint64_t e = min(end, b + grain);
+					commit2([fn, b, e] {
+						(*fn)(b, e);
+					});
+				}
+			}
+
+			// 同 commitRange, 等待所有块执行完, 不可在池内线程中调用
+			template<class F>
+			void parallelFor(uint64_t begin, uint64_t end, uint64_t grain, F &&f) {
+				if (begin >= end) return;
+				latch done{static_cast<ptrdiff_t>(end - begin)};
+				commitRange(begin, end, grain, [&f, &done](uint64_t b, uint64_t e) {
+					f(b, e);
+					done.count_down(static_cast<ptrdiff_t>(e - b));
+				});
+				done.wait();
+			}
+
+			//空闲线程数量
+			int idlCount() { return _idlThrNum; }
+			//线程数量
+			int thrCount() { return _pool.size(); }
+			//线程绑定的 cpu
+			const vector<uint32_t> &cpus() const { return _cpus; }
+			//参与执行的线程数量
+			uint32_t activeCount() const { return _active; }
+
+			// 限制参与执行的线程数量 [1, thrCount()], 多余的线程在执行完当前任务后等待
+			void setActiveCount(uint32_t size) {
+				size = max<uint32_t>(1, min<uint32_t>(size, _pool.size()));
+				if (!_run || _active.exchange(size) == size)
+					return;
+				_active.notify_all();
+				// 让休眠中的线程重新检查自己是否仍参与执行
+				++_epoch;
+				_epoch.notify_all();
+			}
+
+		private:
+			uint64_t rangeGrain(uint64_t size, uint64_t grain) const {
+				if (grain > 0) return grain;
+				// 每个线程约 8 块, 兼顾窃取与提交开销
+				return max<uint64_t>(1, size / (_queues.size() * 8));
+			}
+
+			void push(Task &&task) {
+				// 工作线程提交到自己的队列, 其他线程轮询分配
+				push(std::move(task), _currentPool == this
+					                      ? _currentIndex
+					                      : _next.fetch_add(1, memory_order_relaxed) % _queues.size());
+			}
+
+			void push(Task &&task, uint32_t idx) {
+				{
+					lock_guard lock{_queues[idx]->lock};
+					_queues[idx]->tasks.emplace_back(std::move(task));
+				}
+				++_pending;
+				if (_sleeping > 0) {
+					++_epoch;
+					_epoch.notify_one(); // 唤醒一个线程执行
+				}
+			}
+
+			bool tryPop(uint32_t idx, Task &task) {
+				auto &queue = *_queues[idx];
+				unique_lock lock{queue.lock, try_to_lock};
+				if (!lock.owns_lock() || queue.tasks.empty())
+					return false;
+				task = std::move(queue.tasks.front()); // 按先进先出从队列取一个 task
+				queue.tasks.pop_front();
+				--_pending;
+				return true;
+			}
+
+			bool tryGet(uint32_t self, Task &task) {
+				if (!_stealOrder.empty()) {
+					for (const auto idx: _stealOrder[self]) {
+						if (tryPop(idx, task))
+							return true;
+					}
+					return false;
+				}
+				const auto size = static_cast<uint32_t>(_queues.size());
+				// 先取自己的队列, 再从其他线程的队列窃取
+				for (uint32_t i = 0; i < size; i++) {
+					if (tryPop((self + i) % size, task))
+						return true;
+				}
+				return false;
+			}
+
+			static void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+				__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+				asm volatile("yield");
+#else
+				this_thread::yield();
+#endif
+			}
+
+			void park(uint32_t self) {
+				++_sleeping;
+				const uint32_t epoch = _epoch.load();
+				// 休眠前再检查一次, 与 push() 中的 ++_pending -> _sleeping 配对
+				// 以及 setActiveCount() 中的 _active -> ++_epoch 配对
+				if (_pending == 0 && _run && self < _active)
+					_epoch.wait(epoch);
+				--_sleeping;
+			}
+
+			// 不参与执行时等待, 返回 false 表示线程池已停止
+			bool waitActive(uint32_t self) {
+				uint32_t active;
+				while (self >= (active = _active.load())) {
+					if (!_run)
+						return false;
+					_active.wait(active);
+				}
+				return true;
+			}
+
+			void bindCpu(uint32_t self) const {
+#if defined(__linux__)
+				if (!_cpus.empty()) {
+					cpu_set_t set;
+					CPU_ZERO(&set);
+					CPU_SET(_cpus[self % _cpus.size()], &set);
+					sched_setaffinity(0, sizeof(set), &set);
+				}
+#endif
+			}
+
+			void workerLoop(uint32_t self) {
+				bindCpu(self);
+				_currentPool = this;
+				_currentIndex = self;
+				uint32_t spin = 0;
+				while (true) //防止 _run==false 时立即结束,此时任务队列可能不为空
+				{
+					if (self >= _active.load(memory_order_relaxed) && !waitActive(self))
+						return;
+					Task task; // 获取一个待执行的 task
+					if (tryGet(self, task)) {
+						--_idlThrNum;
+						task(); //执行任务
+						++_idlThrNum;
+						spin = 0;
+						continue;
+					}
+					if (_pending > 0) {
+						// 任务存在但队列正被占用
+						cpuRelax();
+						continue;
+					}
+					if (!_run)
+						return;
+					if (spin < THREADPOOL_SPIN_COUNT) {
+						++spin;
+						cpuRelax();
+						continue;
+					}
+					spin = 0;
+					park(self);
+				}
+			}
+
+			// 在线程启动前计算, 之后只读
+			void initStealOrder(uint32_t size) {
+				if (_groups.empty())
+					return;
+				_stealOrder.resize(size);
+				for (uint32_t self = 0; self < size; self++) {
+					const uint32_t group = _groups[self % _groups.size()];
+					auto &order = _stealOrder[self];
+					for (const bool sameGroup: {true, false}) {
+						for (uint32_t i = 0; i < size; i++) {
+							const uint32_t idx = (self + i) % size;
+							if ((_groups[idx % _groups.size()] == group) == sameGroup)
+								order.emplace_back(idx);
+						}
+					}
+				}
+			}
+
+			//添加指定数量的线程
+			void addThread(uint32_t size) {
+				size = max<uint32_t>(1, min<uint32_t>(size, THREADPOOL_MAX_NUM));
+				_queues.reserve(size);
+				_active = size;
+				for (uint32_t i = 0; i < size; i++) {
+					_queues.emplace_back(make_unique<WorkQueue>());
+				}
+				initStealOrder(size);
+				for (uint32_t i = 0; i < size; i++) {
+					//增加线程数量,但不超过 预定义数量 THREADPOOL_MAX_NUM
+					++_idlThrNum;
+					_pool.emplace_back([this, i] {
+						workerLoop(i);
+					});
+				}
+			}
+	};
+}
+
+#endif  //https://github.com/lzpong/
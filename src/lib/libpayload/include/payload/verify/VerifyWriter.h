@@ -2,55 +2,25 @@
 #define PAYLOAD_EXTRACT_DMVERIFYHASHTREEGEN_H
 
 #include <cinttypes>
+#include <memory>
 #include <vector>
 
 #include "payload/ExtractConfig.h"
 #include "payload/PartitionInfo.h"
+#include "payload/common/threadpool.h"
 
 #include "VerifyInfo.h"
 
 namespace skkk {
-	class VerifyWriterHashTreeContext {
-		public:
-			const VerifyInfo &verifyInfo;
-			const uint8_t *inData;
-			uint64_t readFilePos;
-			uint64_t writeHashPos;
-			uint8_t *hashData = nullptr;
-
-			VerifyWriterHashTreeContext(const VerifyInfo &verifyInfo, const uint8_t *inData, uint64_t readFilePos,
-			                            uint64_t writeHashPos, uint8_t *hashData)
-				: verifyInfo(verifyInfo),
-				  inData(inData),
-				  readFilePos(readFilePos),
-				  writeHashPos(writeHashPos),
-				  hashData(hashData) {
-			}
-	};
-
-	class VerifyWriterFecContext {
-		public:
-			const VerifyInfo &verifyInfo;
-			uint8_t *fecData = nullptr;
-			const uint8_t *inData = nullptr;
-			uint64_t roundsIdx;
-
-			VerifyWriterFecContext(const VerifyInfo &verifyInfo, uint8_t *fecData, const uint8_t *inData,
-			                       uint64_t roundsIdx)
-				: verifyInfo(verifyInfo),
-				  fecData(fecData),
-				  inData(inData),
-				  roundsIdx(roundsIdx) {
-			}
-	};
-
 	class VerifyWriter {
 		const std::vector<PartitionInfo> &partitions;
 		const ExtractConfig &config;
+		std::shared_ptr<std::threadpool> threadPool;
 		std::vector<VerifyInfo> verifyInfos;
 
 		public:
-			VerifyWriter(const std::vector<PartitionInfo> &partitions, const ExtractConfig &config);
+			VerifyWriter(const std::vector<PartitionInfo> &partitions, const ExtractConfig &config,
+			             const std::shared_ptr<std::threadpool> &threadPool);
 
 			void initHashTreeLevel();
 
@@ -14,6 +14,39 @@ namespace skkk {
 		  sslVerification(sslVerification) {
 	}
 
+	ExtractConfig::ExtractConfig(const ExtractConfig &other)
+		: payloadPath(other.payloadPath),
+		  oldDir(other.oldDir),
+		  outDir(other.outDir),
+		  outConfigPath(other.outConfigPath),
+		  outConfig(other.outConfig),
+		  targetName(other.targetName),
+		  targets(other.targets),
+		  costProfilePath(other.costProfilePath),
+		  priorities(other.priorities),
+		  payloadType(other.payloadType),
+		  isIncremental(other.isIncremental),
+		  isExcludeMode(other.isExcludeMode),
+		  isVerifyUpdate(other.isVerifyUpdate),
+		  isSilent(other.isSilent),
+		  isUrl(other.isUrl),
+		  remoteUpdate(other.remoteUpdate),
+		  sslVerification(other.sslVerification),
+		  scheduleMode(other.scheduleMode),
+		  threadNum(other.threadNum),
+		  hardwareConcurrency(other.hardwareConcurrency),
+		  limitHardwareConcurrency(other.limitHardwareConcurrency),
+		  cpuSet(other.cpuSet),
+		  isNumaBind(other.isNumaBind),
+		  isAdaptiveThreads(other.isAdaptiveThreads),
+		  maxMemory(other.maxMemory),
+		  fetchThreadNum(other.fetchThreadNum),
+		  shardIndex(other.shardIndex),
+		  shardCount(other.shardCount),
+		  jobThreadNum(other.jobThreadNum),
+		  isSparseOutput(other.isSparseOutput) {
+	}
+
 	const std::string &ExtractConfig::getOldDir() const {
 		return oldDir;
 	}
@@ -70,6 +103,23 @@ namespace skkk {
 		targets = target;
 	}
 
+	const std::string &ExtractConfig::getCostProfilePath() const {
+		return costProfilePath;
+	}
+
+	void ExtractConfig::setCostProfilePath(const std::string &path) {
+		strTrim(costProfilePath = path);
+		handleWinPath(costProfilePath);
+	}
+
+	const std::vector<std::string> &ExtractConfig::getPriorities() const {
+		return priorities;
+	}
+
+	void ExtractConfig::setPriorities(const std::vector<std::string> &names) {
+		priorities = names;
+	}
+
 	const std::shared_ptr<HttpDownload> &ExtractConfig::getHttpDownloadImpl() {
 		std::unique_lock lock(_mutex);
 		if (isUrl && !httpDownload) {
@@ -1,8 +1,12 @@
+#include <algorithm>
 #include <random>
 #include <thread>
 #include <bsdiff/bspatch.h>
 
 #include "decompress/Decompress.h"
+#include "lz4diff/Lz4Patch.h"
+#include "puffpatch/PuffPatch.h"
+#include "zucchini/ZucchiniPatch.h"
 #include "payload/FileWriter.h"
 #include "payload/HttpDownload.h"
 #include "payload/update_metadata.pb.h"
@@ -21,8 +25,8 @@ namespace skkk {
 		return randomWaitTime(mt);
 	}
 
-	FileWriter::FileWriter(const std::shared_ptr<HttpDownload> &httpDownload)
-		: httpDownload(httpDownload) {
+	FileWriter::FileWriter(const std::shared_ptr<HttpDownload> &httpDownload, JobPool *jobPool)
+		: httpDownload(httpDownload), jobPool(jobPool) {
 	}
 
 	int FileWriter::urlRead(uint8_t *buf, const FileOperation &operation) const {
@@ -37,75 +41,103 @@ namespace skkk {
 		goto retry;
 	}
 
-	int FileWriter::commonWrite(const decompressPtr &decompress, const uint8_t *payloadData, uint8_t *outData,
-	                            const FileOperation &operation) const {
-		int ret = -1;
-		uint8_t *srcData = nullptr;
-		Buffer<uint8_t> srcBuffer;
+	const uint8_t *FileWriter::readOperationData(const uint8_t *payloadData, const FileOperation &operation,
+	                                             Buffer<uint8_t> &buffer) const {
+		if (operation.dataLength == 0) return nullptr;
 		if (httpDownload) {
-			srcBuffer.reserve(operation.dataLength);
-			srcData = srcBuffer.get();
-			urlRead(srcData, operation);
-		} else {
-			srcData = const_cast<uint8_t *>(payloadData + operation.dataOffset);
+			buffer.reserve(operation.dataLength);
+			urlRead(buffer.get(), operation);
+			return buffer.get();
 		}
+		return payloadData + operation.dataOffset;
+	}
+
+	bool FileWriter::isContiguous(const std::vector<Extent> &extents) {
+		for (uint64_t i = 1; i < extents.size(); i++) {
+			if (extents[i - 1].dataOffset + extents[i - 1].dataLength != extents[i].dataOffset) {
+				return false;
+			}
+		}
+		return !extents.empty();
+	}
+
+	int FileWriter::commonWrite(const decompressPtr &decompress, const uint8_t *srcData, uint8_t *outData,
+	                            const FileOperation &operation) const {
+		int ret = -1;
 		if (srcData) {
-			auto &dst = operation.dstExtents[0];
-			Buffer<uint8_t> destBuffer{dst.dataLength};
-			if (auto *destBuf = destBuffer.get()) {
-				uint64_t outDestLength = dst.dataLength;
-				ret = decompress(srcData, operation.dataLength, destBuf, outDestLength);
-				if (!ret) {
-					ret = memcpy(outData + dst.dataOffset, destBuf, dst.dataLength) ? 0 : -EIO;
-				}
+			// The decoder writes straight into the output mapping, extent by extent
+			auto &dsts = operation.dstExtents;
+			if (dsts.size() > 1 && isContiguous(dsts)) {
+				Extent dst;
+				dst.dataOffset = dsts[0].dataOffset;
+				dst.dataLength = operation.dstTotalLength;
+				return decompress(srcData, operation.dataLength, outData, {dst});
 			}
+			ret = decompress(srcData, operation.dataLength, outData, dsts);
 		}
 		return ret;
 	}
 
-	int FileWriter::directWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) const {
+	int FileWriter::directWrite(const uint8_t *srcData, uint8_t *outData, const FileOperation &operation) const {
 		int ret = -1;
-		uint8_t *srcData = nullptr;
-		Buffer<uint8_t> srcBuffer;
-		if (httpDownload) {
-			srcBuffer.reserve(operation.dataLength);
-			srcData = srcBuffer.get();
-			urlRead(srcData, operation);
-		} else {
-			srcData = const_cast<uint8_t *>(payloadData + operation.dataOffset);
-		}
 		if (srcData) {
-			auto &dst = operation.dstExtents[0];
-			ret = memcpy(outData + dst.dataOffset, srcData, dst.dataLength) ? 0 : -EIO;
+			if (operation.dataLength < operation.dstTotalLength) return -EBADMSG;
+			ret = extentsWrite(outData, srcData, operation.dstExtents);
 		}
 		return ret;
 	}
 
-	int FileWriter::bzipWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) const {
-		int ret = commonWrite(Decompress::bzipDecompress,
-		                      payloadData, outData, operation);
+	int FileWriter::bzipWrite(const uint8_t *srcData, uint8_t *outData, const FileOperation &operation) const {
+		int ret;
+		if (srcData && jobPool && operation.dstTotalLength >= PARALLEL_DECODE_MIN_SIZE &&
+		    isContiguous(operation.dstExtents)) {
+			ret = Decompress::bzipDecompressBlocks(srcData, operation.dataLength,
+			                                       outData + operation.dstExtents[0].dataOffset,
+			                                       operation.dstTotalLength, *jobPool,
+			                                       MemoryBudget::helperEstimate(operation));
+			// Single block, or a wrong block boundary, decode as one stream
+			if (ret != -ENOTSUP) return ret;
+		}
+		ret = commonWrite(Decompress::bzipDecompress,
+		                  srcData, outData, operation);
 		return ret;
 	}
 
-	int FileWriter::zeroWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) {
-		int ret = -1;
-		auto &dst = operation.dstExtents[0];
-		Buffer<uint8_t> srcBuffer{0, dst.dataLength};
-		if (auto *srcData = srcBuffer.get()) {
-			ret = memcpy(outData + dst.dataOffset, srcData, dst.dataLength) ? 0 : -EIO;
+	int FileWriter::zeroWrite(uint8_t *outData, int outFd, const FileOperation &operation) {
+		// No dst extents left: the blocks are FILL or DONT_CARE chunks of a sparse image
+		int ret = 0;
+		for (const auto &dst: operation.dstExtents) {
+			// Holes of a fresh output file are zeros already, the others are zeroed without writing data
+			if (outFd >= 0 && (blobIsHole(outFd, dst.dataOffset, dst.dataLength) ||
+			                   !blobPunchHole(outFd, dst.dataOffset, dst.dataLength) ||
+			                   !blobFallocate(outFd, dst.dataOffset, dst.dataLength))) {
+				continue;
+			}
+			ret = memset(outData + dst.dataOffset, 0, dst.dataLength) ? 0 : -EIO;
+			if (ret) return ret;
 		}
 		return ret;
 	}
 
-	int FileWriter::xzWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) const {
-		int ret = commonWrite(Decompress::xzDecompress,
-		                      payloadData, outData, operation);
+	int FileWriter::xzWrite(const uint8_t *srcData, uint8_t *outData, const FileOperation &operation) const {
+		int ret;
+		if (srcData && jobPool && operation.dstTotalLength >= PARALLEL_DECODE_MIN_SIZE &&
+		    isContiguous(operation.dstExtents)) {
+			ret = Decompress::xzDecompressBlocks(srcData, operation.dataLength,
+			                                     outData + operation.dstExtents[0].dataOffset,
+			                                     operation.dstTotalLength, *jobPool,
+			                                     MemoryBudget::helperEstimate(operation));
+			// Single block, no index or a block that failed to decode, decode as one stream
+			if (ret != -ENOTSUP) return ret;
+		}
+		ret = commonWrite(Decompress::xzDecompress,
+		                  srcData, outData, operation);
 		return ret;
 	}
 
-	int FileWriter::zstdWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) const {
+	int FileWriter::zstdWrite(const uint8_t *srcData, uint8_t *outData, const FileOperation &operation) const {
 		int ret = commonWrite(Decompress::zstdDecompress,
-		                      payloadData, outData, operation);
+		                      srcData, outData, operation);
 		return ret;
 	}
 
@@ -131,49 +163,58 @@ namespace skkk {
 
 	int FileWriter::sourceCopy(const uint8_t *inData, uint8_t *outData, const FileOperation &operation) {
 		int ret = -1;
-		auto &dst = operation.dstExtents[0];
+		if (operation.srcTotalLength < operation.dstTotalLength) return -EBADMSG;
 		Buffer<uint8_t> srcBuffer{operation.srcTotalLength};
 		if (auto *srcData = srcBuffer.get()) {
 			ret = extentsRead(inData, srcData, operation.srcExtents);
 			if (!ret) {
-				ret = memcpy(outData + dst.dataOffset, srcData, dst.dataLength) ? 0 : -EIO;
+				ret = extentsWrite(outData, srcData, operation.dstExtents);
 			}
 		}
 		return ret;
 	}
 
-	int FileWriter::brotliBSDiff(const uint8_t *payloadData, const uint8_t *inData, uint8_t *outData,
-	                             const FileOperation &operation) const {
-		int ret = -1;
+	const uint8_t *FileWriter::sourceData(const uint8_t *inData, const FileOperation &operation,
+	                                      Buffer<uint8_t> &buffer) {
 		auto &srcs = operation.srcExtents;
+		if (isContiguous(srcs)) return inData + srcs[0].dataOffset;
+		buffer.reserve(operation.srcTotalLength);
+		if (!buffer.get() || extentsRead(inData, buffer.get(), srcs)) return nullptr;
+		return buffer.get();
+	}
+
+	int FileWriter::bsDiff(const uint8_t *patchData, const uint8_t *inData, uint8_t *outData,
+	                       const FileOperation &operation) {
+		int ret = -1;
 		auto &dsts = operation.dstExtents;
-		uint64_t patchDataLength = operation.dataLength;
-		uint8_t *patchData = nullptr;
-		Buffer<uint8_t> patchBuffer;
-		if (httpDownload) {
-			patchBuffer.reserve(patchDataLength);
-			patchData = patchBuffer.get();
-			urlRead(patchData, operation);
-		} else {
-			patchData = const_cast<uint8_t *>(payloadData + operation.dataOffset);
-		}
 		if (patchData) {
-			uint64_t srcTotalLength = operation.srcTotalLength;
-			Buffer<uint8_t> srcBuffer{srcTotalLength};
-			if (auto *srcData = srcBuffer.get()) {
-				ret = extentsRead(inData, srcData, operation.srcExtents);
-				if (!ret) {
-					std::vector<uint8_t> patchedData;
-					patchedData.reserve(operation.dstTotalLength);
-					auto sink = [&patchedData](const uint8_t *data, size_t len) {
-						patchedData.insert(patchedData.end(), data, data + len);
-						return len;
-					};
-					ret = bsdiff::bspatch(srcData, srcTotalLength,
-					                      patchData, patchDataLength, sink);
-					if (!ret) {
-						ret = extentsWrite(outData, patchedData.data(), dsts);
+			Buffer<uint8_t> srcBuffer;
+			if (auto *srcData = sourceData(inData, operation, srcBuffer)) {
+				// The patched data goes straight to the dst extents, in order
+				uint64_t patchedSize = 0, extentIndex = 0, extentPos = 0;
+				auto sink = [outData, &dsts, &patchedSize, &extentIndex, &extentPos, &operation](
+					const uint8_t *data, size_t len) -> size_t {
+					if (patchedSize + len > operation.dstTotalLength) return 0;
+					for (size_t left = len; left > 0;) {
+						auto &dst = dsts[extentIndex];
+						const uint64_t size = std::min<uint64_t>(left, dst.dataLength - extentPos);
+						memcpy(outData + dst.dataOffset + extentPos, data, size);
+						data += size;
+						left -= size;
+						extentPos += size;
+						if (extentPos == dst.dataLength) {
+							extentIndex++;
+							extentPos = 0;
+						}
 					}
+					patchedSize += len;
+					return len;
+				};
+				// bspatch tells BSDIFF40 (bzip2) and BSDF2 (brotli and others) patches apart
+				ret = bsdiff::bspatch(srcData, operation.srcTotalLength,
+				                      patchData, operation.dataLength, sink);
+				if (!ret && patchedSize != operation.dstTotalLength) {
+					ret = -EBADMSG;
 				}
 			}
 		}
@@ -181,30 +222,89 @@ namespace skkk {
 		return ret;
 	}
 
-	int FileWriter::writeDataByType(const uint8_t *payloadData, const uint8_t *inData, uint8_t *outData,
+	int FileWriter::patchWrite(const patchPtr &patch, const uint8_t *patchData, const uint8_t *inData,
+	                           uint8_t *outData, const FileOperation &operation) {
+		int ret = -1;
+		auto &dsts = operation.dstExtents;
+		if (patchData) {
+			Buffer<uint8_t> srcBuffer;
+			if (auto *srcData = sourceData(inData, operation, srcBuffer)) {
+				// Patched straight into the output mapping when the dst extents allow it
+				if (isContiguous(dsts)) {
+					return patch(srcData, operation.srcTotalLength, patchData, operation.dataLength,
+					             outData + dsts[0].dataOffset, operation.dstTotalLength);
+				}
+				Buffer<uint8_t> dstBuffer{operation.dstTotalLength};
+				ret = patch(srcData, operation.srcTotalLength, patchData, operation.dataLength,
+				            dstBuffer.get(), operation.dstTotalLength);
+				if (!ret) {
+					ret = extentsWrite(outData, dstBuffer.get(), dsts);
+				}
+			}
+		}
+		return ret;
+	}
+
+	int FileWriter::puffDiff(const uint8_t *patchData, const uint8_t *inData, uint8_t *outData,
+	                         const FileOperation &operation) {
+		return patchWrite(PuffPatch::apply, patchData, inData, outData, operation);
+	}
+
+	int FileWriter::zucchiniDiff(const uint8_t *patchData, const uint8_t *inData, uint8_t *outData,
+	                             const FileOperation &operation) {
+		return patchWrite(ZucchiniPatch::apply, patchData, inData, outData, operation);
+	}
+
+	int FileWriter::lz4Diff(const uint8_t *patchData, const uint8_t *inData, uint8_t *outData,
+	                        const FileOperation &operation) {
+		return patchWrite(Lz4Patch::apply, patchData, inData, outData, operation);
+	}
+
+	int FileWriter::writeDataByType(const uint8_t *payloadData, const uint8_t *inData, uint8_t *outData, int outFd,
 	                                const FileOperation &operation) const {
+		Buffer<uint8_t> dataBuffer;
+		const uint8_t *operationData = readOperationData(payloadData, operation, dataBuffer);
+		return writeOperation(operationData, inData, outData, outFd, operation);
+	}
+
+	int FileWriter::writeOperation(const uint8_t *operationData, const uint8_t *inData, uint8_t *outData, int outFd,
+	                               const FileOperation &operation) const {
 		int ret = -1;
 		switch (operation.type) {
 			case InstallOperation_Type_REPLACE:
-				ret = directWrite(payloadData, outData, operation);
+				ret = directWrite(operationData, outData, operation);
 				break;
 			case InstallOperation_Type_REPLACE_BZ:
-				ret = bzipWrite(payloadData, outData, operation);
+				ret = bzipWrite(operationData, outData, operation);
 				break;
 			case InstallOperation_Type_SOURCE_COPY:
 				ret = sourceCopy(inData, outData, operation);
 				break;
 			case InstallOperation_Type_ZERO:
-				ret = zeroWrite(nullptr, outData, operation);
+			// Discarded data reads back as zeros
+			case InstallOperation_Type_DISCARD:
+				ret = zeroWrite(outData, outFd, operation);
 				break;
 			case InstallOperation_Type_REPLACE_XZ:
-				ret = xzWrite(payloadData, outData, operation);
+				ret = xzWrite(operationData, outData, operation);
 				break;
+			case InstallOperation_Type_BSDIFF:
+			case InstallOperation_Type_SOURCE_BSDIFF:
 			case InstallOperation_Type_BROTLI_BSDIFF:
-				ret = brotliBSDiff(payloadData, inData, outData, operation);
+				ret = bsDiff(operationData, inData, outData, operation);
 				break;
 			case InstallOperation_Type_REPLACE_ZSTD:
-				ret = zstdWrite(payloadData, outData, operation);
+				ret = zstdWrite(operationData, outData, operation);
+				break;
+			case InstallOperation_Type_PUFFDIFF:
+				ret = puffDiff(operationData, inData, outData, operation);
+				break;
+			case InstallOperation_Type_ZUCCHINI:
+				ret = zucchiniDiff(operationData, inData, outData, operation);
+				break;
+			case InstallOperation_Type_LZ4DIFF_BSDIFF:
+			case InstallOperation_Type_LZ4DIFF_PUFFDIFF:
+				ret = lz4Diff(operationData, inData, outData, operation);
 				break;
 			default:
 				ret = -1;
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <format>
+
+#include "payload/MemoryBudget.h"
+#include "payload/update_metadata.pb.h"
+#include "payload/common/Buffer.hpp"
+#include "decompress/Decompress.h"
+
+using namespace chromeos_update_engine;
+
+namespace skkk {
+	// Decoder working memory, independent of the operation size
+	static constexpr uint64_t BZIP_STATE_SIZE = 4ULL << 20;
+	static constexpr uint64_t XZ_STATE_SIZE = 9ULL << 20;
+	static constexpr uint64_t ZSTD_STATE_SIZE = 256ULL << 10;
+	static constexpr uint64_t BROTLI_STATE_SIZE = 17ULL << 20;
+	// Puffed deflate data is about the size of the inflated data
+	static constexpr uint64_t PUFF_SIZE_FACTOR = 3;
+	// EROFS lz4 clusters decompress to about twice their size
+	static constexpr uint64_t LZ4_SIZE_FACTOR = 2;
+
+	MemoryBudget::MemoryBudget(uint64_t limit, bool isUrl) : limit(limit), isUrl(isUrl) {
+	}
+
+	uint64_t MemoryBudget::estimate(const FileOperation &operation) const {
+		const uint64_t payloadSize = isUrl ? operation.dataLength : 0;
+		switch (operation.type) {
+			case InstallOperation_Type_REPLACE:
+				return payloadSize;
+			// Decoded straight into the output mapping
+			case InstallOperation_Type_REPLACE_BZ:
+				return payloadSize + BZIP_STATE_SIZE;
+			case InstallOperation_Type_REPLACE_XZ:
+				return payloadSize + XZ_STATE_SIZE;
+			case InstallOperation_Type_REPLACE_ZSTD:
+				return payloadSize + ZSTD_STATE_SIZE;
+			case InstallOperation_Type_ZERO:
+			case InstallOperation_Type_DISCARD:
+				return 0;
+			case InstallOperation_Type_SOURCE_COPY:
+				return operation.srcTotalLength;
+			// The src data is only gathered into a buffer for scattered src extents
+			case InstallOperation_Type_BROTLI_BSDIFF:
+				return payloadSize + operation.srcTotalLength + BROTLI_STATE_SIZE;
+			// BSDIFF40 holds three bzip2 streams
+			case InstallOperation_Type_BSDIFF:
+			case InstallOperation_Type_SOURCE_BSDIFF:
+				return payloadSize + operation.srcTotalLength + 3 * BZIP_STATE_SIZE;
+			case InstallOperation_Type_PUFFDIFF:
+				return payloadSize + operation.srcTotalLength + operation.dstTotalLength + BROTLI_STATE_SIZE +
+				       PUFF_SIZE_FACTOR * (operation.srcTotalLength + operation.dstTotalLength);
+			// The decoded patch is about the size of dst
+			case InstallOperation_Type_ZUCCHINI:
+				return payloadSize + operation.srcTotalLength + 2 * operation.dstTotalLength + BROTLI_STATE_SIZE;
+			case InstallOperation_Type_LZ4DIFF_BSDIFF:
+			case InstallOperation_Type_LZ4DIFF_PUFFDIFF:
+				return payloadSize + operation.srcTotalLength + operation.dstTotalLength + BROTLI_STATE_SIZE +
+				       LZ4_SIZE_FACTOR * (operation.srcTotalLength + operation.dstTotalLength);
+			default:
+				return payloadSize + operation.srcTotalLength + operation.dstTotalLength;
+		}
+	}
+
+	uint64_t MemoryBudget::helperEstimate(const FileOperation &operation) {
+		switch (operation.type) {
+			case InstallOperation_Type_REPLACE_BZ:
+				// The window of decoded blocks is charged to the operation by bzipDecompressBlocks
+				return BZIP_STATE_SIZE + Decompress::BzipStreamSize;
+			// Blocks are decoded straight into the output mapping
+			case InstallOperation_Type_REPLACE_XZ:
+				return XZ_STATE_SIZE;
+			default:
+				return 0;
+		}
+	}
+
+	void MemoryBudget::acquire(uint64_t size) {
+		if (size == 0) return;
+		std::unique_lock lock{mutex};
+		if (used > 0 && used + size > limit) {
+			waitCount++;
+			cv.wait(lock, [this, size] { return used == 0 || used + size <= limit; });
+		}
+		used += size;
+		peak = std::max(peak, used);
+	}
+
+	bool MemoryBudget::tryAcquire(uint64_t size) {
+		if (size == 0) return true;
+		std::lock_guard lock{mutex};
+		if (used > 0 && used + size > limit) return false;
+		used += size;
+		peak = std::max(peak, used);
+		return true;
+	}
+
+	void MemoryBudget::release(uint64_t size) {
+		if (size == 0) return;
+		{
+			std::lock_guard lock{mutex};
+			used -= size;
+		}
+		cv.notify_all();
+	}
+
+	std::string MemoryBudget::summary() {
+		std::lock_guard lock{mutex};
+		return std::format("budget: {}, peak estimated: {}, peak allocated: {}, waits: {}",
+		                   formatSize(limit), formatSize(peak), formatSize(BufferStats::getPeak()), waitCount);
+	}
+
+	bool MemoryBudget::parseSize(const std::string &str, uint64_t &size) {
+		// strtoull takes a sign and wraps negative values around
+		if (str.empty() || !isdigit(static_cast<unsigned char>(str[0]))) return false;
+		char *endPtr;
+		errno = 0;
+		const uint64_t value = strtoull(str.c_str(), &endPtr, 10);
+		if (errno == ERANGE) return false;
+		uint32_t shift = 0;
+		switch (*endPtr) {
+			case 'k':
+			case 'K':
+				shift = 10;
+				break;
+			case 'm':
+			case 'M':
+				shift = 20;
+				break;
+			case 'g':
+			case 'G':
+				shift = 30;
+				break;
+			case '\0':
+				break;
+			default:
+				return false;
+		}
+		if (shift > 0 && *++endPtr != '\0') return false;
+		if (value > UINT64_MAX >> shift) return false;
+		size = value << shift;
+		return size > 0;
+	}
+
+	std::string MemoryBudget::formatSize(uint64_t size) {
+		if (size >= 1ULL << 30) return std::format("{:.2f}G", static_cast<double>(size) / (1ULL << 30));
+		if (size >= 1ULL << 20) return std::format("{:.2f}M", static_cast<double>(size) / (1ULL << 20));
+		if (size >= 1ULL << 10) return std::format("{:.2f}K", static_cast<double>(size) / (1ULL << 10));
+		return std::format("{}B", size);
+	}
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cstdio>
+#include <format>
+#include <ranges>
+#include <string>
+
+#include "payload/OperationCostModel.h"
+#include "payload/update_metadata.pb.h"
+#include "payload/Utils.h"
+#include "payload/common/io.h"
+
+using namespace chromeos_update_engine;
+
+namespace skkk {
+	OperationCostModel::OperationCostModel() {
+		dataWeight.fill(0);
+		nsPerByte.fill(1.0);
+
+		nsPerByte[InstallOperation_Type_REPLACE] = 0.2;
+		nsPerByte[InstallOperation_Type_ZERO] = 0.1;
+		nsPerByte[InstallOperation_Type_DISCARD] = 0.1;
+		nsPerByte[InstallOperation_Type_SOURCE_COPY] = 0.3;
+
+		dataWeight[InstallOperation_Type_REPLACE_BZ] = 1.0;
+		nsPerByte[InstallOperation_Type_REPLACE_BZ] = 12.0;
+		dataWeight[InstallOperation_Type_REPLACE_XZ] = 4.0;
+		nsPerByte[InstallOperation_Type_REPLACE_XZ] = 3.0;
+		dataWeight[InstallOperation_Type_REPLACE_ZSTD] = 1.0;
+		nsPerByte[InstallOperation_Type_REPLACE_ZSTD] = 0.5;
+
+		for (const auto type: {
+			     InstallOperation_Type_BSDIFF, InstallOperation_Type_SOURCE_BSDIFF,
+			     InstallOperation_Type_BROTLI_BSDIFF, InstallOperation_Type_PUFFDIFF,
+			     InstallOperation_Type_ZUCCHINI, InstallOperation_Type_LZ4DIFF_BSDIFF,
+			     InstallOperation_Type_LZ4DIFF_PUFFDIFF
+		     }) {
+			dataWeight[type] = 8.0;
+			nsPerByte[type] = 2.0;
+		}
+	}
+
+	uint64_t OperationCostModel::weightedBytes(const FileOperation &operation) const {
+		const auto type = operation.type < TYPE_SIZE ? operation.type : 0;
+		return static_cast<uint64_t>(dataWeight[type] * operation.dataLength) + operation.dstTotalLength;
+	}
+
+	uint64_t OperationCostModel::estimate(const FileOperation &operation) const {
+		const auto type = operation.type < TYPE_SIZE ? operation.type : 0;
+		return static_cast<uint64_t>(nsPerByte[type] * weightedBytes(operation));
+	}
+
+	void OperationCostModel::record(const FileOperation &operation, uint64_t ns) const {
+		if (operation.type < TYPE_SIZE) {
+			recordedNs[operation.type] += ns;
+			recordedBytes[operation.type] += weightedBytes(operation);
+		}
+	}
+
+	/**
+	 * LPT(longest processing time first), stable for equal costs.
+	 */
+	std::vector<const FileOperation *> OperationCostModel::sortByCost(
+		const std::vector<FileOperation> &operations) const {
+		std::vector<std::pair<uint64_t, const FileOperation *>> costs;
+		costs.reserve(operations.size());
+		for (const auto &operation: operations) {
+			costs.emplace_back(estimate(operation), &operation);
+		}
+		std::ranges::stable_sort(costs, std::ranges::greater{},
+		                         &std::pair<uint64_t, const FileOperation *>::first);
+		std::vector<const FileOperation *> sorted;
+		sorted.reserve(costs.size());
+		for (const auto &operation: costs | std::views::values) {
+			sorted.emplace_back(operation);
+		}
+		return sorted;
+	}
+
+	/**
+	 * One line per operation type: [type:nsPerByte]
+	 */
+	bool OperationCostModel::loadProfile(const std::string &path) {
+		std::vector<std::string> lines;
+		if (!readAllLines(path, lines)) return false;
+		std::vector<std::string> split;
+		for (const auto &line: lines) {
+			splitString(split, line, ":", true);
+			if (split.size() == 2) {
+				char *endPtr;
+				const uint64_t type = strtoull(split[0].c_str(), &endPtr, 0);
+				const double value = strtod(split[1].c_str(), &endPtr);
+				if (type < TYPE_SIZE && value > 0) {
+					nsPerByte[type] = value;
+				}
+			}
+			split.clear();
+		}
+		return true;
+	}
+
+	bool OperationCostModel::saveProfile(const std::string &path) const {
+		if (auto *file = fopen(path.c_str(), "wb")) {
+			for (uint32_t type = 0; type < TYPE_SIZE; type++) {
+				const uint64_t bytes = recordedBytes[type];
+				const double value = bytes > 0
+					                     ? static_cast<double>(recordedNs[type]) / static_cast<double>(bytes)
+					                     : nsPerByte[type];
+				fprintf(file, "%s\n", std::format("{}:{:.6f}", type, value).c_str());
+			}
+			fclose(file);
+			return true;
+		}
+		return false;
+	}
+}
@@ -1,22 +1,33 @@
 #include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <future>
+#include <map>
 #include <memory>
 #include <print>
 #include <ranges>
+#include <set>
 
 #include "common/LogProgress.h"
-#include "common/threadpool.h"
+#include "decompress/Decompress.h"
 #include "payload/FileWriter.h"
 #include "payload/PartitionWriter.h"
 #include "payload/Utils.h"
+#include "payload/common/Buffer.hpp"
+#include "payload/common/CpuTopology.h"
 #include "payload/common/io.h"
 #include "payload/mman/mmap.hpp"
 
 namespace skkk {
-	PartitionWriter::PartitionWriter(const std::shared_ptr<PayloadInfo> &payloadInfo)
+	PartitionWriter::PartitionWriter(const std::shared_ptr<PayloadInfo> &payloadInfo,
+	                                 const std::shared_ptr<std::threadpool> &threadPool)
 		: payloadInfo(payloadInfo),
-		  config(payloadInfo->getConfig()) {
+		  config(payloadInfo->getConfig()),
+		  threadPool(threadPool) {
+		costModel = std::make_shared<OperationCostModel>();
+		if (auto &path = config.getCostProfilePath(); !path.empty() && fileExists(path)) {
+			costModel->loadProfile(path);
+		}
 	}
 
 	bool PartitionWriter::initPartitions() {
@@ -24,7 +35,9 @@ namespace skkk {
 		     const auto &info: partitionInfoMap | std::views::values) {
 			partitions.emplace_back(info);
 		}
-		return !partitions.empty();
+		sortByPriority();
+		selectShardOperations();
+		return !partitions.empty() && initSparseImages();
 	}
 
 	bool PartitionWriter::initPartitionsByTarget() {
@@ -42,7 +55,52 @@ namespace skkk {
 					partitions.emplace_back(partitionInfoMap[name]);
 				}
 		}
-		return !partitions.empty();
+		sortByPriority();
+		selectShardOperations();
+		return !partitions.empty() && initSparseImages();
+	}
+
+	/**
+	 * Partitions in the priority list go first, in the order of the list,
+	 * the others keep their order. Their operations are committed first as well.
+	 */
+	void PartitionWriter::sortByPriority() {
+		auto &priorities = config.getPriorities();
+		if (priorities.empty()) return;
+		auto rank = [&priorities](const PartitionInfo &info) {
+			return std::ranges::distance(priorities.begin(), std::ranges::find(priorities, info.name));
+		};
+		std::ranges::stable_sort(partitions, {}, rank);
+	}
+
+	void PartitionWriter::selectShardOperations() {
+		if (isShardMode()) {
+			shardOperations = ShardManifest::selectOperations(partitions, config.shardIndex, config.shardCount);
+		}
+	}
+
+	bool PartitionWriter::initSparseImages() {
+		if (!config.isSparseOutput) return true;
+		for (auto &info: partitions) {
+			auto &sparseImage = sparseImages[info.name];
+			if (!sparseImage.init(info)) {
+				LOGCE("{}: Cannot build the sparse image from the dst extents", info.name);
+				return false;
+			}
+			for (auto &operation: info.operations) {
+				sparseImage.translate(operation);
+			}
+		}
+		return true;
+	}
+
+	const SparseImage *PartitionWriter::getSparseImage(const PartitionInfo &info) const {
+		const auto it = sparseImages.find(info.name);
+		return it != sparseImages.end() ? &it->second : nullptr;
+	}
+
+	void PartitionWriter::setPartitionDoneCallback(const PartitionDoneCallback &callback) {
+		partitionDoneCallback = callback;
 	}
 
 	void PartitionWriter::printPartitionsInfo() const {
@@ -67,9 +125,9 @@ namespace skkk {
 		return true;
 	}
 
-	int PartitionWriter::createOutFile(const std::string &path, uint64_t fileSize) {
+	int PartitionWriter::createOutFile(const std::string &path, uint64_t fileSize, bool isTruncate) {
 		int fd = open(path.c_str(),
-		              O_CREAT | O_RDWR | O_TRUNC | O_BINARY, 0644);
+		              O_CREAT | O_RDWR | (isTruncate ? O_TRUNC : 0) | O_BINARY, 0644);
 		if (fd > 0) {
 			if (!payload_ftruncate(fd, fileSize)) return fd;
 		}
@@ -95,10 +153,40 @@ namespace skkk {
 		return partitions;
 	}
 
+	/**
+	 * In shard mode the operations of other shards are left out and counted as done.
+	 */
+	std::vector<const FileOperation *> PartitionWriter::getScheduledOperations(const PartitionInfo &info) const {
+		std::vector<const FileOperation *> operations;
+		if (config.scheduleMode == SCHEDULE_LPT) {
+			operations = costModel->sortByCost(info.operations);
+		} else {
+			operations.reserve(info.operations.size());
+			for (const auto &operation: info.operations) {
+				operations.emplace_back(&operation);
+			}
+		}
+		if (isShardMode()) {
+			std::erase_if(operations, [this](const FileOperation *operation) {
+				return !isInShard(*operation);
+			});
+			*info.extractProgress += info.operations.size() - operations.size();
+		}
+		return operations;
+	}
+
+	/**
+	 * Operations per task, 0: about eight tasks per thread.
+	 * LPT keeps one operation per task, a chunk would put the largest operations in one task.
+	 */
+	static uint64_t getOperationGrain(int scheduleMode) {
+		return scheduleMode == SCHEDULE_LPT ? 1 : 0;
+	}
+
 	std::shared_ptr<VerifyWriter> PartitionWriter::getVerifyWriter() {
 		std::unique_lock lock{_mutex};
 		if (!verifyWriter) {
-			verifyWriter = std::make_shared<VerifyWriter>(partitions, config);
+			verifyWriter = std::make_shared<VerifyWriter>(partitions, config, threadPool);
 		}
 		return verifyWriter;
 	}
@@ -124,9 +212,14 @@ namespace skkk {
 		}
 	}
 
-	static bool handleData(const PartitionInfo &info, bool isIncremental, int &inFd, int &outFd,
-	                       const uint8_t *&inData, uint64_t &inDataSize, uint8_t *&outData, uint64_t &outDataSize) {
+	/**
+	 * sparseImage: layout of the output file in sparse output mode, nullptr for a raw image.
+	 */
+	static bool handleData(const PartitionInfo &info, bool isIncremental, bool isSharedOut,
+	                       const SparseImage *sparseImage, int &inFd, int &outFd, const uint8_t *&inData,
+	                       uint64_t &inDataSize, uint8_t *&outData, uint64_t &outDataSize) {
 		int ret = -1;
+		const uint64_t outFileSize = sparseImage ? sparseImage->fileSize : info.size;
 		if (isIncremental) {
 			ret = mapRdByPath(inFd, info.oldFilePath, inData, inDataSize);
 			if (ret) {
@@ -134,7 +227,10 @@ namespace skkk {
 				goto exit;
 			}
 		}
-		outFd = PartitionWriter::initOutFd(info.outFilePath, info.size);
+		// Other shards may write to the same file at the same time, never truncate it
+		outFd = isSharedOut
+			        ? PartitionWriter::createOutFile(info.outFilePath, outFileSize, false)
+			        : PartitionWriter::initOutFd(info.outFilePath, outFileSize);
 		if (outFd < 0) {
 			info.initExcInfoByInitFd(info.outFilePath, outFd);
 			ret = outFd;
@@ -143,6 +239,8 @@ namespace skkk {
 		ret = mapRwByPath(outFd, info.outFilePath, outData, outDataSize);
 		if (ret) {
 			info.initExcInfoByInitFd(info.outFilePath, ret);
+		} else if (sparseImage) {
+			sparseImage->writeHeaders(outData);
 		}
 	exit:
 		return ret == 0;
@@ -159,7 +257,7 @@ namespace skkk {
 		uint64_t outDataSize = 0;
 		uint8_t *outData = nullptr;
 
-		if (!handleData(info, config.isIncremental, inFd, outFd,
+		if (!handleData(info, config.isIncremental, isShardMode(), getSparseImage(info), inFd, outFd,
 		                inData, inDataSize, outData, outDataSize)) {
 			goto exit;
 		}
@@ -167,9 +265,11 @@ namespace skkk {
 		progressThread = std::async(std::launch::async, printProgressMT, config.isSilent, info.name,
 		                            info.size, info.operations.size(), std::ref(*extractProgress), true);
 		for (const auto &operation: info.operations) {
-			ret = fw.writeDataByType(payloadBinData, inData, outData, operation);
-			if (ret) {
-				operation.initExcInfo(ret);
+			if (isInShard(operation)) {
+				ret = fw.writeDataByType(payloadBinData, inData, outData, outFd, operation);
+				if (ret) {
+					operation.initExcInfo(ret);
+				}
 			}
 			++*extractProgress;
 		}
@@ -184,53 +284,76 @@ namespace skkk {
 		return info.checkExtractionSuccessful();
 	}
 
-	static void extractTask(const PartitionWriteContext &ctx) {
-		int ret = -1;
-		const auto &fileWriter = ctx.fileWriter;
-		const auto &operation = ctx.operation;
-		const auto &extractProgress = ctx.partitionInfo.extractProgress;
-		const auto *payloadData = ctx.payloadData;
-		const auto *inData = ctx.inData;
-		auto *outData = ctx.outData;
-
-		ret = fileWriter.writeDataByType(payloadData, inData, outData, operation);
+	/**
+	 * costModel: records the time of the operation, nullptr if no cost profile is written.
+	 */
+	static void extractTask(const FileWriter &fileWriter, const uint8_t *payloadData, const uint8_t *inData,
+	                        uint8_t *outData, int outFd, const FileOperation &operation,
+	                        std::atomic_int &extractProgress, MemoryBudget *memoryBudget,
+	                        const OperationCostModel *costModel) {
+		int ret = 0;
+		{
+			const MemoryBudgetGuard budgetGuard{memoryBudget, operation};
+			const auto start = std::chrono::steady_clock::now();
+			ret = fileWriter.writeDataByType(payloadData, inData, outData, outFd, operation);
+			if (!ret && costModel) {
+				const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start).count();
+				costModel->record(operation, ns);
+			}
+		}
 		if (ret) {
 			operation.initExcInfo(ret);
 		}
-		++*extractProgress;
+		++extractProgress;
 	}
 
 	bool PartitionWriter::extractByInfoMT(const PartitionInfo &info) const {
 		int inFd = -1, outFd = -1;
 		const auto payloadData = payloadInfo->getPayloadData();
 		const auto &extractProgress = info.extractProgress;
-		const auto isIncremental = config.isIncremental;
-		FileWriter fw{config.httpDownload};
+		const bool isRecordCost = !config.getCostProfilePath().empty();
 		uint64_t inDataSize = 0;
 		const uint8_t *inData = nullptr;
 		uint64_t outDataSize = 0;
 		uint8_t *outData = nullptr;
 
-		if (!handleData(info, config.isIncremental, inFd, outFd,
+		if (!handleData(info, config.isIncremental, isShardMode(), getSparseImage(info), inFd, outFd,
 		                inData, inDataSize, outData, outDataSize)) {
 			goto exit;
 		}
 
 		// wait
 		{
-			uint64_t opSize = info.operations.size();
-			std::vector<PartitionWriteContext> ctxs;
-			ctxs.reserve(opSize);
-			std::threadpool tp(config.threadNum);
-			for (const auto &operation: info.operations) {
-				auto &ctx = ctxs.emplace_back(info, fw, operation, payloadData,
-				                              inData, outData, isIncremental);
-				tp.commit(extractTask, std::ref(ctx));
+			// Progress counts the operations of other shards as done
+			const uint64_t opSize = info.operations.size();
+			const auto operations = getScheduledOperations(info);
+			std::unique_ptr<MemoryBudget> memoryBudget;
+			if (config.maxMemory > 0) {
+				memoryBudget = std::make_unique<MemoryBudget>(config.maxMemory, config.httpDownload != nullptr);
 			}
+			JobPool jobPool{*threadPool, nullptr, memoryBudget.get()};
+			FileWriter fw{config.httpDownload, &jobPool};
+			std::latch done{static_cast<std::ptrdiff_t>(operations.size())};
+			const uint64_t grain = getOperationGrain(config.scheduleMode);
+			threadPool->commitRange(0, operations.size(), grain, [&](uint64_t begin, uint64_t end) {
+				for (uint64_t i = begin; i < end; i++) {
+					extractTask(fw, payloadData, inData, outData, outFd, *operations[i], *extractProgress,
+					            memoryBudget.get(), isRecordCost ? costModel.get() : nullptr);
+				}
+				done.count_down(static_cast<std::ptrdiff_t>(end - begin));
+			});
 			printProgressMT(config.isSilent, info.name, info.size, opSize,
 			                *extractProgress, true);
+			done.wait();
+			if (memoryBudget) {
+				LOGCI("Memory: {}", memoryBudget->summary());
+			}
 		}
 		info.initExcInfos();
+		if (isRecordCost) {
+			costModel->saveProfile(config.getCostProfilePath());
+		}
 
 	exit:
 		unmap(inData, inDataSize);
@@ -263,29 +386,355 @@ namespace skkk {
 		      name, ret ? GREEN2_BOLD("success") : RED2("fail"));
 	}
 
+	static void finishPartitionTask(PartitionExtractContext &ctx) {
+		ctx.partitionInfo.initExcInfos();
+		unmap(ctx.inData, ctx.inDataSize);
+		unmap(ctx.outData, ctx.outDataSize);
+		closeFd(ctx.inFd);
+		closeFd(ctx.outFd);
+		if (ctx.partitionDoneCallback && *ctx.partitionDoneCallback) {
+			(*ctx.partitionDoneCallback)(ctx.partitionInfo, ctx.partitionInfo.checkExtractionSuccessful());
+		}
+		ctx.done.count_down();
+	}
+
+	/**
+	 * operationData: payload data already fetched by the prefetcher, or nullptr to read it here.
+	 * memoryBudget: nullptr if the prefetcher has reserved the budget of the operation already.
+	 */
+	static void extractOperation(const FileWriter &fileWriter, const uint8_t *payloadData,
+	                             const uint8_t *operationData, MemoryBudget *memoryBudget,
+	                             PartitionExtractContext &ctx, const FileOperation &operation) {
+		const MemoryBudgetGuard budgetGuard{memoryBudget, operation};
+		const auto start = std::chrono::steady_clock::now();
+		int ret = operationData
+			          ? fileWriter.writeOperation(operationData, ctx.inData, ctx.outData, ctx.outFd, operation)
+			          : fileWriter.writeDataByType(payloadData, ctx.inData, ctx.outData, ctx.outFd, operation);
+		if (ret) {
+			operation.initExcInfo(ret);
+		} else if (ctx.costModel) {
+			const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			ctx.costModel->record(operation, ns);
+		}
+		if (ctx.threadTuner) {
+			ctx.threadTuner->addBytes(operation.dstTotalLength);
+		}
+		++*ctx.partitionInfo.extractProgress;
+	}
+
+	static void finishOperations(PartitionExtractContext &ctx, uint64_t count) {
+		if ((ctx.pendingSize -= count) == 0) {
+			finishPartitionTask(ctx);
+		}
+	}
+
+	static void extractGlobalTask(const FileWriter &fileWriter, const uint8_t *payloadData,
+	                              PartitionExtractContext &ctx, uint64_t begin, uint64_t end) {
+		for (uint64_t i = begin; i < end; i++) {
+			extractOperation(fileWriter, payloadData, nullptr, ctx.memoryBudget, ctx, *ctx.operations[i]);
+		}
+		finishOperations(ctx, end - begin);
+	}
+
+	static void extractPrefetchedTask(const FileWriter &fileWriter, const uint8_t *operationData,
+	                                  PartitionExtractContext &ctx, const FileOperation &operation) {
+		extractOperation(fileWriter, nullptr, operationData, nullptr, ctx, operation);
+		finishOperations(ctx, 1);
+	}
+
+	/**
+	 * All partitions share one pool, the operations of every partition are committed up front,
+	 * so idle threads continue with the next partition while the current one drains.
+	 * Small partitions run as a single task each, including opening and mapping their files.
+	 * In URL mode the payload data is downloaded by separate fetch threads ahead of the decode pool.
+	 * Progress and results are still printed in partition order.
+	 */
+	void PartitionWriter::extractPartitionsMT() const {
+		const auto payloadData = payloadInfo->getPayloadData();
+		const bool isRecordCost = !config.getCostProfilePath().empty();
+		std::vector<std::unique_ptr<PartitionExtractContext>> ctxs;
+		ctxs.reserve(partitions.size());
+
+		// wait
+		{
+			auto &tp = *threadPool;
+			std::unique_ptr<ThreadTuner> threadTuner;
+			if (config.isAdaptiveThreads) {
+				threadTuner = std::make_unique<ThreadTuner>(tp, config.hardwareConcurrency);
+			}
+			std::unique_ptr<MemoryBudget> memoryBudget;
+			if (config.maxMemory > 0) {
+				memoryBudget = std::make_unique<MemoryBudget>(config.maxMemory, config.httpDownload != nullptr);
+			}
+			// Other payloads may share the pool, limit the tasks of this one
+			std::shared_ptr<TaskLimiter> taskLimiter;
+			if (config.jobThreadNum > 0 && config.jobThreadNum < static_cast<uint32_t>(tp.thrCount())) {
+				taskLimiter = std::make_shared<TaskLimiter>(tp, config.jobThreadNum);
+			}
+			JobPool jobPool{tp, taskLimiter, memoryBudget.get()};
+			FileWriter fw{config.httpDownload, &jobPool};
+			auto commit = [&jobPool](auto &&task) {
+				jobPool.commit(std::forward<decltype(task)>(task));
+			};
+			std::unique_ptr<OperationPrefetcher> prefetcher;
+			if (config.httpDownload) {
+				const uint32_t fetchThreadNum = config.fetchThreadNum > 0 ? config.fetchThreadNum : tp.thrCount();
+				prefetcher = std::make_unique<OperationPrefetcher>(fw, memoryBudget.get(), fetchThreadNum,
+				                                                   tp.thrCount() * 2);
+			}
+			// numa node -> workers, only used if the workers span more than one node
+			std::map<uint32_t, std::vector<uint32_t>> nodeWorkers;
+			std::map<uint32_t, uint64_t> nodeBytes;
+			if (config.isNumaBind && !tp.cpus().empty()) {
+				nodeWorkers = CpuTopology().workersByNode(tp.cpus(), tp.thrCount());
+				if (nodeWorkers.size() < 2) nodeWorkers.clear();
+			}
+			auto openPartition = [this](PartitionExtractContext &ctx) {
+				const auto &info = ctx.partitionInfo;
+				if (!handleData(info, config.isIncremental, isShardMode(), getSparseImage(info), ctx.inFd,
+				                ctx.outFd, ctx.inData, ctx.inDataSize, ctx.outData, ctx.outDataSize)
+				    || info.operations.empty()) {
+					finishPartitionTask(ctx);
+					return false;
+				}
+				ctx.operations = getScheduledOperations(info);
+				ctx.pendingSize = ctx.operations.size();
+				if (ctx.operations.empty()) {
+					// All operations belong to other shards
+					finishPartitionTask(ctx);
+					return false;
+				}
+				return true;
+			};
+			// Small: too few operations to fill the pool, and too little data to become the longest task
+			const uint64_t threadNum = std::max(tp.thrCount(), 1);
+			uint64_t totalSize = 0;
+			for (const auto &info: partitions) {
+				totalSize += info.size;
+			}
+			const uint64_t operationGrain = getOperationGrain(config.scheduleMode);
+			auto isSmallPartition = [threadNum, totalSize, &prefetcher](const PartitionInfo &info) {
+				return !prefetcher && info.operations.size() < threadNum && info.size <= totalSize / threadNum;
+			};
+			for (const auto &info: partitions) {
+				auto &ctx = *ctxs.emplace_back(std::make_unique<PartitionExtractContext>(info));
+				ctx.partitionDoneCallback = &partitionDoneCallback;
+				ctx.costModel = isRecordCost ? costModel.get() : nullptr;
+				ctx.threadTuner = threadTuner.get();
+				ctx.memoryBudget = memoryBudget.get();
+				if (isSmallPartition(info)) {
+					LOGCD("{}: single task", info.name);
+					commit([&openPartition, &fw, payloadData, &ctx] {
+						if (openPartition(ctx)) {
+							extractGlobalTask(fw, payloadData, ctx, 0, ctx.operations.size());
+						}
+					});
+					continue;
+				}
+				if (!openPartition(ctx)) {
+					continue;
+				}
+				ctx.isSubmitted = true;
+				if (prefetcher) {
+					// Operations without payload data go through the fetch threads as well: the budget is
+					// only ever waited for there, never on a decode worker that queued decodes wait for
+					for (uint64_t i = 0; i < ctx.operations.size(); i++) {
+						const auto &operation = *ctx.operations[i];
+						prefetcher->fetch(commit, operation, [&fw, &ctx, &operation](const uint8_t *operationData) {
+							extractPrefetchedTask(fw, operationData, ctx, operation);
+						});
+					}
+					continue;
+				}
+				if (nodeWorkers.empty()) {
+					jobPool.commitRange(0, ctx.operations.size(), operationGrain, [&fw, payloadData, &ctx](uint64_t b, uint64_t e) {
+						extractGlobalTask(fw, payloadData, ctx, b, e);
+					});
+					continue;
+				}
+				// The whole partition goes to the least loaded node, its pages are mostly first
+				// touched by the workers of that node: workers steal within their own node first,
+				// from another node only once their node has no tasks left.
+				const auto &[node, workers] = *std::ranges::min_element(
+					nodeWorkers, {}, [&nodeBytes](const auto &entry) {
+						return nodeBytes[entry.first] / entry.second.size();
+					});
+				nodeBytes[node] += info.size;
+				LOGCD("{}: numa node{}", info.name, node);
+				const uint64_t opNum = ctx.operations.size();
+				const uint64_t grain = operationGrain > 0 ? operationGrain : jobPool.rangeGrain(opNum);
+				for (uint64_t begin = 0, chunk = 0; begin < opNum; begin += grain, chunk++) {
+					const uint64_t end = std::min(opNum, begin + grain);
+					jobPool.commitTo(workers[chunk % workers.size()], [&fw, payloadData, &ctx, begin, end] {
+						extractGlobalTask(fw, payloadData, ctx, begin, end);
+					});
+				}
+			}
+
+			for (const auto &ctx: ctxs) {
+				const auto &info = ctx->partitionInfo;
+				if (ctx->isSubmitted) {
+					printProgressMT(config.isSilent, info.name, info.size, info.operations.size(),
+					                *info.extractProgress, true);
+				}
+				ctx->done.wait();
+				bool ret = info.checkExtractionSuccessful();
+				if (!ret) {
+					info.ifExcExistsWrite2File();
+				}
+				printExtractResult(info.name, ret);
+			}
+			if (threadTuner) {
+				threadTuner->stop();
+				LOGCI("Adaptive threads: {}", threadTuner->summary());
+			}
+			if (memoryBudget) {
+				LOGCI("Memory: {}", memoryBudget->summary());
+			}
+			LOGCD("Decoders: {}", Decompress::contextStats());
+		}
+		if (isRecordCost) {
+			costModel->saveProfile(config.getCostProfilePath());
+		}
+	}
+
 	void PartitionWriter::extractPartitions() const {
 		if (!partitions.empty()) {
 			bool ret = false;
 			const auto threadNum = config.threadNum;
 			const auto isIncremental = config.isIncremental;
 			printExtractConfig(threadNum, isIncremental);
+			if (threadNum > 1 && !threadPool->cpus().empty()) {
+				LOGCI("Topology: {}", CpuTopology().describe(threadPool->cpus(), threadPool->thrCount()));
+			}
 			if (threadNum > 1) {
-				for (const auto &info: partitions) {
-					ret = extractByInfoMT(info);
-					if (!ret) {
-						info.ifExcExistsWrite2File();
-					}
-					printExtractResult(info.name, ret);
-				}
+				extractPartitionsMT();
 			} else {
 				for (const auto &info: partitions) {
 					ret = extractByInfo(info);
+					if (partitionDoneCallback) {
+						partitionDoneCallback(info, ret);
+					}
 					if (!ret) {
 						info.ifExcExistsWrite2File();
 					}
 					printExtractResult(info.name, ret);
 				}
 			}
+			if (isShardMode() && !writeShardManifest()) {
+				LOGCE("Write shard manifest fail");
+			}
+		}
+	}
+
+	/**
+	 * Extents of successfully extracted partitions only, a failed partition shows up as missing on merge.
+	 */
+	bool PartitionWriter::writeShardManifest() const {
+		ShardManifest manifest;
+		manifest.shardIndex = config.shardIndex;
+		manifest.shardCount = config.shardCount;
+		for (const auto &info: partitions) {
+			if (!info.isExtractionSuccessful) continue;
+			manifest.files[info.name] = info.outFilePath;
+			auto &extents = manifest.extents[info.name];
+			for (const auto &operation: info.operations) {
+				if (!isInShard(operation)) continue;
+				for (const auto &extent: operation.dstExtents) {
+					extents.emplace_back(extent.dataOffset, extent.dataLength);
+				}
+			}
+		}
+		const auto path = ShardManifest::getManifestPath(config.getOutDir(), config.shardIndex, config.shardCount);
+		LOGCI("Shard {}/{} manifest: '{}'", config.shardIndex, config.shardCount, path);
+		return manifest.save(path);
+	}
+
+	static int copyExtent(int inFd, int outFd, uint64_t offset, uint64_t length) {
+		constexpr uint64_t chunkSize = 1 << 20;
+		Buffer<uint8_t> buffer{std::min(length, chunkSize)};
+		for (uint64_t done = 0; done < length;) {
+			const uint64_t size = std::min(length - done, chunkSize);
+			int ret = blobRead(inFd, buffer.get(), offset + done, size);
+			if (!ret) ret = blobWrite(outFd, buffer.get(), offset + done, size);
+			if (ret) return ret;
+			done += size;
+		}
+		return 0;
+	}
+
+	bool PartitionWriter::mergeShards(const std::vector<std::string> &manifestPaths) const {
+		std::vector<ShardManifest> manifests(manifestPaths.size());
+		std::set<uint32_t> shardIndexes;
+		for (uint32_t i = 0; i < manifestPaths.size(); i++) {
+			auto &manifest = manifests[i];
+			if (!manifest.load(manifestPaths[i])) {
+				LOGCE("Invalid shard manifest: '{}'", manifestPaths[i]);
+				return false;
+			}
+			if (manifest.shardCount != manifests[0].shardCount || !shardIndexes.emplace(manifest.shardIndex).second) {
+				LOGCE("Shard manifest does not match the others: '{}'", manifestPaths[i]);
+				return false;
+			}
+		}
+		if (manifests.empty() || shardIndexes.size() != manifests[0].shardCount) {
+			LOGCE("Shard manifests: {}, expected: {}", shardIndexes.size(),
+			      manifests.empty() ? 0 : manifests[0].shardCount);
+			return false;
+		}
+
+		bool isAllSuccessful = true;
+		for (const auto &info: partitions) {
+			bool ret = true;
+			int outFd = -1;
+			// [offset, length] -> written by n shards
+			std::map<std::pair<uint64_t, uint64_t>, uint32_t> written;
+			for (const auto &manifest: manifests) {
+				auto it = manifest.extents.find(info.name);
+				if (it == manifest.extents.end()) continue;
+				auto fileIt = manifest.files.find(info.name);
+				int inFd = -1;
+				if (fileIt != manifest.files.end() && fileIt->second != info.outFilePath) {
+					inFd = openFileRD(fileIt->second);
+					if (outFd < 0) outFd = createOutFile(info.outFilePath, info.size, false);
+					if (inFd < 0 || outFd < 0) {
+						info.initExcInfoByInitFd(inFd < 0 ? fileIt->second : info.outFilePath,
+						                         inFd < 0 ? inFd : outFd);
+						ret = false;
+					}
+				}
+				for (const auto &[offset, length]: it->second) {
+					written[{offset, length}]++;
+					if (inFd > 0 && outFd > 0 && ret) {
+						ret = copyExtent(inFd, outFd, offset, length) == 0;
+					}
+				}
+				closeFd(inFd);
+			}
+			closeFd(outFd);
+
+			uint64_t missing = 0, duplicate = 0, expected = 0;
+			for (const auto &operation: info.operations) {
+				for (const auto &extent: operation.dstExtents) {
+					auto it = written.find({extent.dataOffset, extent.dataLength});
+					if (it == written.end()) missing++;
+					else if (it->second > 1) duplicate++;
+					expected++;
+				}
+			}
+			// Written extents that are no dst extent of this partition
+			const uint64_t unknown = written.size() + missing - expected;
+			if (missing || duplicate || unknown) {
+				LOGCE("{}: extents missing: {}, duplicate: {}, unknown: {}", info.name, missing, duplicate, unknown);
+				ret = false;
+			}
+			if (!ret) {
+				info.ifExcExistsWrite2File();
+			}
+			printExtractResult(info.name, ret);
+			isAllSuccessful &= ret;
 		}
+		return isAllSuccessful;
 	}
 }
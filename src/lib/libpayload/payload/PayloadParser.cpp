@@ -1,8 +1,17 @@
+#include <algorithm>
 #include <stdexcept>
 
 #include "payload/PayloadParser.h"
+#include "payload/common/CpuTopology.h"
 
 namespace skkk {
+	void PayloadParser::setThreadPool(const std::shared_ptr<std::threadpool> &pool) {
+		std::unique_lock lock(_mutex);
+		if (!initialized) {
+			threadPool = pool;
+		}
+	}
+
 	bool PayloadParser::parse(const ExtractConfig &config) {
 		std::unique_lock lock(_mutex);
 		if (!initialized) {
@@ -20,14 +29,32 @@ namespace skkk {
 				}
 			}
 			if (info && info->initPayloadInfo()) {
+				if (!threadPool) {
+					threadPool = createThreadPool(config);
+				}
 				payloadInfo = info;
-				partitionWriter = std::make_shared<PartitionWriter>(payloadInfo);
+				partitionWriter = std::make_shared<PartitionWriter>(payloadInfo, threadPool);
 			}
 			return initialized = (payloadInfo && partitionWriter);
 		}
 		return false;
 	}
 
+	std::shared_ptr<std::threadpool> PayloadParser::createThreadPool(const ExtractConfig &config) {
+		const uint32_t threadNum = std::max(config.threadNum, 1U);
+		auto cpus = config.cpuSet;
+		// Idle workers steal from the workers of their own node first
+		std::vector<uint32_t> workerNodes;
+		if (config.isNumaBind) {
+			const CpuTopology topology;
+			if (cpus.empty()) {
+				cpus = topology.allowedCpus;
+			}
+			workerNodes = topology.workerNodes(cpus, threadNum);
+		}
+		return std::make_shared<std::threadpool>(threadNum, cpus, workerNodes);
+	}
+
 	static void throwNoInit() {
 		throw std::runtime_error("PayloadParser is not initialized!");
 	}
@@ -43,4 +70,10 @@ namespace skkk {
 		if (!initialized) throwNoInit();
 		return partitionWriter;
 	}
+
+	std::shared_ptr<std::threadpool> PayloadParser::getThreadPool() {
+		std::unique_lock lock(_mutex);
+		if (!initialized) throwNoInit();
+		return threadPool;
+	}
 }
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cstdio>
+#include <format>
+#include <ranges>
+
+#include "payload/ShardManifest.h"
+#include "payload/Utils.h"
+#include "payload/common/io.h"
+
+namespace skkk {
+	std::unordered_set<const FileOperation *> ShardManifest::selectOperations(
+		const std::vector<PartitionInfo> &partitions, uint32_t shardIndex, uint32_t shardCount) {
+		std::vector<const PartitionInfo *> sortedPartitions;
+		for (const auto &info: partitions) {
+			sortedPartitions.emplace_back(&info);
+		}
+		std::ranges::sort(sortedPartitions, {}, &PartitionInfo::name);
+
+		std::vector<const FileOperation *> operations;
+		for (const auto *info: sortedPartitions) {
+			for (const auto &operation: info->operations) {
+				operations.emplace_back(&operation);
+			}
+		}
+		std::ranges::stable_sort(operations, std::ranges::greater{}, &FileOperation::dstTotalLength);
+
+		std::unordered_set<const FileOperation *> selected;
+		std::vector<uint64_t> shardBytes(shardCount, 0);
+		for (const auto *operation: operations) {
+			const auto shard = std::ranges::distance(shardBytes.begin(), std::ranges::min_element(shardBytes));
+			// Operations without dst data still count, so they are spread as well
+			shardBytes[shard] += std::max<uint64_t>(operation->dstTotalLength, 1);
+			if (shard == shardIndex) {
+				selected.emplace(operation);
+			}
+		}
+		return selected;
+	}
+
+	std::string ShardManifest::getManifestPath(const std::string &outDir, uint32_t shardIndex,
+	                                           uint32_t shardCount) {
+		return std::format("{}/shard_{}_of_{}.txt", outDir, shardIndex, shardCount);
+	}
+
+	bool ShardManifest::load(const std::string &path) {
+		std::vector<std::string> lines;
+		if (!readAllLines(path, lines)) return false;
+		std::vector<std::string> split;
+		for (const auto &line: lines) {
+			split.clear();
+			if (line.starts_with("file:")) {
+				// The path may contain ':'
+				const auto pos = line.find(':', 5);
+				if (pos == std::string::npos) return false;
+				files[line.substr(5, pos - 5)] = line.substr(pos + 1);
+				continue;
+			}
+			splitString(split, line, ":", true);
+			if (split.size() == 3 && split[0] == "shard") {
+				shardIndex = strtoul(split[1].c_str(), nullptr, 10);
+				shardCount = strtoul(split[2].c_str(), nullptr, 10);
+			} else if (split.size() == 4 && split[0] == "extent") {
+				extents[split[1]].emplace_back(strtoull(split[2].c_str(), nullptr, 10),
+				                               strtoull(split[3].c_str(), nullptr, 10));
+			} else if (!line.empty()) {
+				return false;
+			}
+		}
+		return shardCount > 0 && shardIndex < shardCount;
+	}
+
+	bool ShardManifest::save(const std::string &path) const {
+		if (auto *file = fopen(path.c_str(), "wb")) {
+			fprintf(file, "%s\n", std::format("shard:{}:{}", shardIndex, shardCount).c_str());
+			for (const auto &[name, filePath]: files) {
+				fprintf(file, "%s\n", std::format("file:{}:{}", name, filePath).c_str());
+			}
+			for (const auto &[name, partExtents]: extents) {
+				for (const auto &[offset, length]: partExtents) {
+					fprintf(file, "%s\n", std::format("extent:{}:{}:{}", name, offset, length).c_str());
+				}
+			}
+			// A full disk shows up as a write error or only when the buffer is flushed
+			const bool isWriteFailed = ferror(file);
+			return fclose(file) == 0 && !isWriteFailed;
+		}
+		return false;
+	}
+}
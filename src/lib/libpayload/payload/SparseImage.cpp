@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cstring>
+
+#include "payload/SparseImage.h"
+#include "payload/update_metadata.pb.h"
+
+using namespace chromeos_update_engine;
+
+namespace skkk {
+	static constexpr uint16_t SPARSE_MAJOR_VERSION = 1;
+	static constexpr uint16_t SPARSE_MINOR_VERSION = 0;
+	static constexpr uint32_t FILL_VALUE_SIZE = 4;
+
+	// Little endian, as libsparse writes it
+	class SparseHeader {
+		public:
+			uint32_t magic;
+			uint16_t majorVersion;
+			uint16_t minorVersion;
+			uint16_t fileHeaderSize;
+			uint16_t chunkHeaderSize;
+			uint32_t blockSize;
+			uint32_t totalBlocks;
+			uint32_t totalChunks;
+			// Optional, 0: not checked
+			uint32_t imageChecksum;
+	};
+
+	class SparseChunkHeader {
+		public:
+			uint16_t type;
+			uint16_t reserved;
+			// Blocks in the output image
+			uint32_t chunkSize;
+			// Bytes in the sparse file, header included
+			uint32_t totalSize;
+	};
+
+	static_assert(sizeof(SparseHeader) == SparseImage::FILE_HEADER_SIZE);
+	static_assert(sizeof(SparseChunkHeader) == SparseImage::CHUNK_HEADER_SIZE);
+
+	static uint16_t getChunkType(const FileOperation &operation) {
+		switch (operation.type) {
+			case InstallOperation_Type_ZERO:
+				return SPARSE_CHUNK_FILL;
+			case InstallOperation_Type_DISCARD:
+				return SPARSE_CHUNK_DONT_CARE;
+			default:
+				return SPARSE_CHUNK_RAW;
+		}
+	}
+
+	static uint64_t getChunkDataSize(const SparseChunk &chunk, uint32_t blockSize) {
+		switch (chunk.type) {
+			case SPARSE_CHUNK_RAW:
+				return chunk.numBlocks * blockSize;
+			case SPARSE_CHUNK_FILL:
+				return FILL_VALUE_SIZE;
+			default:
+				return 0;
+		}
+	}
+
+	bool SparseImage::init(const PartitionInfo &info) {
+		blockSize = info.blockSize;
+		if (blockSize == 0 || info.size % blockSize) return false;
+		totalBlocks = info.size / blockSize;
+		if (totalBlocks > UINT32_MAX) return false;
+
+		std::vector<SparseChunk> ranges;
+		for (const auto &operation: info.operations) {
+			const auto type = getChunkType(operation);
+			for (const auto &dst: operation.dstExtents) {
+				if (dst.numBlocks == 0) continue;
+				if (dst.startBlock + dst.numBlocks > totalBlocks) return false;
+				ranges.emplace_back(type, dst.startBlock, dst.numBlocks);
+			}
+		}
+		std::ranges::sort(ranges, {}, &SparseChunk::startBlock);
+
+		// Adjacent ranges of the same type merge, a RAW chunk is limited by its u32 byte size
+		const uint64_t maxRawBlocks = (UINT32_MAX - CHUNK_HEADER_SIZE) / blockSize;
+		auto addChunk = [this, maxRawBlocks](uint16_t type, uint64_t startBlock, uint64_t numBlocks) {
+			const uint64_t maxBlocks = type == SPARSE_CHUNK_RAW ? maxRawBlocks : UINT32_MAX;
+			while (numBlocks > 0) {
+				if (!chunks.empty()) {
+					auto &last = chunks.back();
+					if (last.type == type && last.numBlocks < maxBlocks) {
+						const uint64_t n = std::min(numBlocks, maxBlocks - last.numBlocks);
+						last.numBlocks += n;
+						startBlock += n;
+						numBlocks -= n;
+						continue;
+					}
+				}
+				const uint64_t n = std::min(numBlocks, maxBlocks);
+				chunks.emplace_back(type, startBlock, n);
+				startBlock += n;
+				numBlocks -= n;
+			}
+		};
+		chunks.clear();
+		uint64_t block = 0;
+		for (const auto &range: ranges) {
+			if (range.startBlock < block) return false;
+			addChunk(SPARSE_CHUNK_DONT_CARE, block, range.startBlock - block);
+			addChunk(range.type, range.startBlock, range.numBlocks);
+			block = range.startBlock + range.numBlocks;
+		}
+		addChunk(SPARSE_CHUNK_DONT_CARE, block, totalBlocks - block);
+
+		uint64_t offset = FILE_HEADER_SIZE;
+		for (auto &chunk: chunks) {
+			chunk.fileOffset = offset;
+			offset += CHUNK_HEADER_SIZE + getChunkDataSize(chunk, blockSize);
+		}
+		fileSize = offset;
+		return true;
+	}
+
+	void SparseImage::translate(FileOperation &operation) const {
+		if (getChunkType(operation) != SPARSE_CHUNK_RAW) {
+			operation.dstExtents.clear();
+			return;
+		}
+		std::vector<Extent> extents;
+		for (const auto &dst: operation.dstExtents) {
+			uint64_t block = dst.startBlock;
+			uint64_t numBlocks = dst.numBlocks;
+			// The chunk containing the first block, init() made sure there is one
+			auto it = std::ranges::upper_bound(chunks, block, {}, &SparseChunk::startBlock) - 1;
+			while (numBlocks > 0) {
+				const uint64_t n = std::min(numBlocks, it->startBlock + it->numBlocks - block);
+				auto &extent = extents.emplace_back(dst.blockSize, block, n);
+				extent.dataOffset = it->fileOffset + CHUNK_HEADER_SIZE + (block - it->startBlock) * blockSize;
+				block += n;
+				numBlocks -= n;
+				++it;
+			}
+		}
+		operation.dstExtents = std::move(extents);
+	}
+
+	void SparseImage::writeHeaders(uint8_t *outData) const {
+		const SparseHeader header = {
+			SPARSE_HEADER_MAGIC, SPARSE_MAJOR_VERSION, SPARSE_MINOR_VERSION,
+			FILE_HEADER_SIZE, CHUNK_HEADER_SIZE, blockSize,
+			static_cast<uint32_t>(totalBlocks), static_cast<uint32_t>(chunks.size()), 0
+		};
+		memcpy(outData, &header, sizeof(header));
+		for (const auto &chunk: chunks) {
+			const uint64_t dataSize = getChunkDataSize(chunk, blockSize);
+			const SparseChunkHeader chunkHeader = {
+				chunk.type, 0, static_cast<uint32_t>(chunk.numBlocks),
+				static_cast<uint32_t>(CHUNK_HEADER_SIZE + dataSize)
+			};
+			memcpy(outData + chunk.fileOffset, &chunkHeader, sizeof(chunkHeader));
+			if (chunk.type == SPARSE_CHUNK_FILL) {
+				// ZERO blocks, filled with 0
+				memset(outData + chunk.fileOffset + CHUNK_HEADER_SIZE, 0, FILL_VALUE_SIZE);
+			}
+		}
+	}
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <time.h>
+
+#include "payload/LogBase.h"
+#include "payload/ThreadTuner.h"
+
+namespace skkk {
+	/**
+	 * Cpu time of all threads of this process, 0: unknown.
+	 */
+	static uint64_t processCpuNs() {
+#if !defined(_WIN32)
+		timespec ts = {};
+		if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+			return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+		}
+#endif
+		return 0;
+	}
+
+	ThreadTuner::ThreadTuner(std::threadpool &threadPool, uint32_t cpuLimit)
+		: threadPool(threadPool), cpuLimit(std::max(cpuLimit, 1U)), initialActive(threadPool.activeCount()) {
+		threadPool.setActiveCount(this->cpuLimit);
+		minActive = maxActive = threadPool.activeCount();
+		thread = std::thread(&ThreadTuner::run, this);
+	}
+
+	ThreadTuner::~ThreadTuner() {
+		stop();
+	}
+
+	void ThreadTuner::run() {
+		const uint32_t poolSize = threadPool.thrCount();
+		uint64_t lastBytes = doneBytes;
+		uint64_t lastCpuNs = processCpuNs();
+		auto lastTime = std::chrono::steady_clock::now();
+		double lastThroughput = 0;
+		int direction = 1;
+
+		std::unique_lock lock{mutex};
+		while (!cv.wait_for(lock, std::chrono::milliseconds(INTERVAL_MS), [this] { return isStop; })) {
+			const auto now = std::chrono::steady_clock::now();
+			const uint64_t bytes = doneBytes;
+			const uint64_t cpuNs = processCpuNs();
+			const double wallNs = std::chrono::duration<double, std::nano>(now - lastTime).count();
+			const uint32_t active = threadPool.activeCount();
+			const double throughput = static_cast<double>(bytes - lastBytes) / wallNs;
+			const bool isIoBound = cpuNs > 0 &&
+			                       static_cast<double>(cpuNs - lastCpuNs) < IO_BOUND_UTILIZATION * wallNs * active;
+			lastBytes = bytes;
+			lastCpuNs = cpuNs;
+			lastTime = now;
+			samples++;
+			if (isIoBound) ioBoundSamples++;
+
+			// Nothing finished in this interval (long operations), keep the current setting
+			if (throughput == 0) continue;
+
+			// Waiting threads do not need a cpu, decoding threads do
+			const uint32_t ceiling = isIoBound ? poolSize : std::min(cpuLimit, poolSize);
+			// The last step made it slower, go back
+			if (throughput < lastThroughput * 0.95) direction = -direction;
+			lastThroughput = throughput;
+			uint32_t next = std::clamp<int64_t>(static_cast<int64_t>(active) + direction, 1, ceiling);
+			if (next == active) direction = -direction;
+			if (next != active) {
+				LOGCD("ThreadTuner: {:.1f} MB/s, {}, active: {} -> {}", throughput * 1000,
+				      isIoBound ? "io bound" : "decode bound", active, next);
+				threadPool.setActiveCount(next);
+				minActive = std::min(minActive, next);
+				maxActive = std::max(maxActive, next);
+			}
+		}
+	}
+
+	void ThreadTuner::stop() {
+		{
+			std::lock_guard lock{mutex};
+			isStop = true;
+		}
+		cv.notify_all();
+		if (thread.joinable()) {
+			thread.join();
+			threadPool.setActiveCount(initialActive);
+		}
+	}
+
+	std::string ThreadTuner::summary() const {
+		return std::format("active threads: {}-{} of {}, io bound: {}/{} samples",
+		                   minActive, maxActive, threadPool.thrCount(), ioBoundSamples, samples);
+	}
+}
@@ -72,7 +72,7 @@ namespace skkk {
 	}
 
 	bool UrlPayloadInfo::handleOffset() {
-		if (Buffer<uint8_t> buffer{HEADER_DATA_SIZE}) {
+		if (Buffer<uint8_t> buffer{0, HEADER_DATA_SIZE}) {
 			auto *data = buffer.get();
 			FileBuffer fb{data, 0};
 			if (!download(fb, 0, HEADER_DATA_SIZE)) return false;
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <format>
+#include <thread>
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#include "payload/Utils.h"
+#include "payload/common/CpuTopology.h"
+#include "payload/common/io.h"
+
+namespace skkk {
+	CpuTopology::CpuTopology() {
+#if defined(__linux__)
+		std::vector<std::string> lines;
+		if (readAllLines("/sys/devices/system/cpu/online", lines)) {
+			parseCpuList(lines[0], onlineCpus);
+		}
+		if (auto *dir = opendir("/sys/devices/system/node")) {
+			while (auto *entry = readdir(dir)) {
+				std::string name = entry->d_name;
+				if (!name.starts_with("node") || name.size() == 4) continue;
+				char *endPtr;
+				const uint32_t node = strtoul(name.c_str() + 4, &endPtr, 10);
+				if (*endPtr != '\0') continue;
+				lines.clear();
+				std::vector<uint32_t> cpus;
+				if (readAllLines("/sys/devices/system/node/" + name + "/cpulist", lines) &&
+				    parseCpuList(lines[0], cpus) && !cpus.empty()) {
+					nodeCpus[node] = cpus;
+				}
+			}
+			closedir(dir);
+		}
+#endif
+		if (onlineCpus.empty()) {
+			const uint32_t size = std::max(std::thread::hardware_concurrency(), 1U);
+			for (uint32_t i = 0; i < size; i++) {
+				onlineCpus.emplace_back(i);
+			}
+		}
+		if (nodeCpus.empty()) {
+			nodeCpus[0] = onlineCpus;
+		}
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+			for (const auto cpu: onlineCpus) {
+				if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set)) {
+					allowedCpus.emplace_back(cpu);
+				}
+			}
+		}
+#endif
+		if (allowedCpus.empty()) {
+			allowedCpus = onlineCpus;
+		}
+	}
+
+	uint32_t CpuTopology::nodeOfCpu(uint32_t cpu) const {
+		for (const auto &[node, cpus]: nodeCpus) {
+			if (std::ranges::binary_search(cpus, cpu)) {
+				return node;
+			}
+		}
+		return 0;
+	}
+
+	uint32_t CpuTopology::availableCpus() {
+		uint32_t count = std::max(std::thread::hardware_concurrency(), 1U);
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+			count = std::min<uint32_t>(count, CPU_COUNT(&set));
+		}
+#endif
+		if (const uint32_t quota = cgroupCpuQuota(); quota > 0) {
+			count = std::min(count, quota);
+		}
+		return count;
+	}
+
+#if defined(__linux__)
+	/**
+	 * v2: cpu.max "max 100000" or "400000 100000"
+	 * v1: cpu.cfs_quota_us "-1" or "400000", cpu.cfs_period_us "100000"
+	 */
+	static double readCgroupQuota(const std::string &dir, bool isV2) {
+		std::vector<std::string> lines;
+		if (isV2) {
+			std::vector<std::string> split;
+			if (readAllLines(dir + "/cpu.max", lines)) {
+				splitString(split, lines[0], " ", true);
+				if (split.size() == 2 && split[0] != "max") {
+					const double quota = strtod(split[0].c_str(), nullptr);
+					const double period = strtod(split[1].c_str(), nullptr);
+					if (quota > 0 && period > 0) return quota / period;
+				}
+			}
+			return 0;
+		}
+		if (readAllLines(dir + "/cpu.cfs_quota_us", lines)) {
+			const double quota = strtod(lines[0].c_str(), nullptr);
+			lines.clear();
+			if (quota > 0 && readAllLines(dir + "/cpu.cfs_period_us", lines)) {
+				const double period = strtod(lines[0].c_str(), nullptr);
+				if (period > 0) return quota / period;
+			}
+		}
+		return 0;
+	}
+#endif
+
+	uint32_t CpuTopology::cgroupCpuQuota() {
+		double result = 0;
+#if defined(__linux__)
+		auto applyQuota = [&result](double quota) {
+			if (quota > 0 && (result == 0 || quota < result)) result = quota;
+		};
+		// Every level of the hierarchy may set a quota, the smallest one wins.
+		// Inside a container the own cgroup is usually mounted as the root.
+		auto walkCgroup = [&applyQuota](const std::string &mount, std::string path, bool isV2) {
+			while (true) {
+				applyQuota(readCgroupQuota(mount + path, isV2));
+				if (path.empty() || path == "/") break;
+				path.resize(path.find_last_of('/'));
+			}
+		};
+		std::vector<std::string> lines;
+		if (readAllLines("/proc/self/cgroup", lines)) {
+			for (const auto &line: lines) {
+				// hierarchy-ID:controller-list:cgroup-path
+				const auto first = line.find(':');
+				const auto second = line.find(':', first + 1);
+				if (first == std::string::npos || second == std::string::npos) continue;
+				const auto controllers = line.substr(first + 1, second - first - 1);
+				const auto path = line.substr(second + 1);
+				if (controllers.empty()) {
+					walkCgroup("/sys/fs/cgroup", path, true);
+					continue;
+				}
+				std::vector<std::string> split;
+				splitString(split, controllers, ",", true);
+				if (std::ranges::find(split, "cpu") != split.end()) {
+					for (const auto &mount: {std::string{"/sys/fs/cgroup/cpu"}, "/sys/fs/cgroup/" + controllers}) {
+						walkCgroup(mount, path, false);
+					}
+				}
+			}
+		}
+#endif
+		return static_cast<uint32_t>(std::ceil(result));
+	}
+
+	std::vector<uint32_t> CpuTopology::workerCpus(const std::vector<uint32_t> &cpus, uint32_t threadNum) {
+		std::vector<uint32_t> result;
+		if (!cpus.empty()) {
+			for (uint32_t i = 0; i < threadNum; i++) {
+				result.emplace_back(cpus[i % cpus.size()]);
+			}
+		}
+		return result;
+	}
+
+	std::map<uint32_t, std::vector<uint32_t>> CpuTopology::workersByNode(const std::vector<uint32_t> &cpus,
+	                                                                     uint32_t threadNum) const {
+		std::map<uint32_t, std::vector<uint32_t>> result;
+		const auto workers = workerCpus(cpus, threadNum);
+		for (uint32_t i = 0; i < workers.size(); i++) {
+			result[nodeOfCpu(workers[i])].emplace_back(i);
+		}
+		return result;
+	}
+
+	std::vector<uint32_t> CpuTopology::workerNodes(const std::vector<uint32_t> &cpus, uint32_t threadNum) const {
+		std::vector<uint32_t> result;
+		for (const auto cpu: workerCpus(cpus, threadNum)) {
+			result.emplace_back(nodeOfCpu(cpu));
+		}
+		return result;
+	}
+
+	std::string CpuTopology::describe(const std::vector<uint32_t> &cpus, uint32_t threadNum) const {
+		std::string result = std::format("online: {}, allowed: {}, nodes: {}", formatCpuList(onlineCpus),
+		                                 formatCpuList(allowedCpus), nodeCpus.size());
+		for (const auto &[node, nodeCpuList]: nodeCpus) {
+			result += std::format("\n    node{}: {}", node, formatCpuList(nodeCpuList));
+		}
+		if (!cpus.empty()) {
+			const auto workers = workerCpus(cpus, threadNum);
+			for (const auto &[node, nodeWorkers]: workersByNode(cpus, threadNum)) {
+				std::vector<uint32_t> used;
+				for (const auto worker: nodeWorkers) {
+					used.emplace_back(workers[worker]);
+				}
+				std::ranges::sort(used);
+				const auto [first, last] = std::ranges::unique(used);
+				used.erase(first, last);
+				result += std::format("\n    workers on node{}: {} -> cpus {}", node, nodeWorkers.size(),
+				                      formatCpuList(used));
+			}
+		}
+		return result;
+	}
+
+	bool CpuTopology::parseCpuList(const std::string &str, std::vector<uint32_t> &cpus) {
+		std::vector<std::string> ranges;
+		std::string list = str;
+		strTrim(list);
+		splitString(ranges, list, ",", true);
+		for (const auto &range: ranges) {
+			char *endPtr;
+			const uint32_t first = strtoul(range.c_str(), &endPtr, 10);
+			if (endPtr == range.c_str()) return false;
+			uint32_t last = first;
+			if (*endPtr == '-') {
+				const char *lastStr = endPtr + 1;
+				last = strtoul(lastStr, &endPtr, 10);
+				if (endPtr == lastStr || last < first) return false;
+			}
+			if (*endPtr != '\0') return false;
+			for (uint32_t cpu = first; cpu <= last; cpu++) {
+				cpus.emplace_back(cpu);
+			}
+		}
+		std::ranges::sort(cpus);
+		const auto [first, last] = std::ranges::unique(cpus);
+		cpus.erase(first, last);
+		return !cpus.empty();
+	}
+
+	std::string CpuTopology::formatCpuList(const std::vector<uint32_t> &cpus) {
+		std::string result;
+		for (size_t i = 0; i < cpus.size();) {
+			size_t j = i;
+			while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+			if (!result.empty()) result += ",";
+			result += i == j ? std::format("{}", cpus[i]) : std::format("{}-{}", cpus[i], cpus[j]);
+			i = j + 1;
+		}
+		return result;
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef PAYLOAD_EXTRACT_PROTOREADER_H
+#define PAYLOAD_EXTRACT_PROTOREADER_H
+
+#include <cinttypes>
+
+namespace skkk {
+	/**
+	 * Just enough of the protobuf wire format for the small headers of the diff patches
+	 */
+	class ProtoReader {
+		const uint8_t *data;
+		const uint8_t *end;
+
+		public:
+			ProtoReader(const uint8_t *data, uint64_t size) : data(data), end(data + size) {
+			}
+
+			bool hasData() const { return data < end; }
+
+			// Unread data, the value of a bytes field read by readMessage
+			const uint8_t *get() const { return data; }
+
+			uint64_t size() const { return end - data; }
+
+			bool readVarint(uint64_t &value) {
+				value = 0;
+				for (uint32_t shift = 0; shift < 64 && data < end; shift += 7) {
+					const uint8_t byte = *data++;
+					value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+					if (!(byte & 0x80)) return true;
+				}
+				return false;
+			}
+
+			bool readField(uint32_t &field, uint32_t &wireType) {
+				uint64_t key;
+				if (!readVarint(key)) return false;
+				field = key >> 3;
+				wireType = key & 0x7;
+				return true;
+			}
+
+			bool readMessage(ProtoReader &message) {
+				uint64_t length;
+				if (!readVarint(length) || length > static_cast<uint64_t>(end - data)) return false;
+				message = ProtoReader{data, length};
+				data += length;
+				return true;
+			}
+
+			bool skip(uint32_t wireType) {
+				uint64_t length;
+				switch (wireType) {
+					case 0:
+						return readVarint(length);
+					case 1:
+						length = 8;
+						break;
+					case 2:
+						if (!readVarint(length)) return false;
+						break;
+					case 5:
+						length = 4;
+						break;
+					default:
+						return false;
+				}
+				if (length > static_cast<uint64_t>(end - data)) return false;
+				data += length;
+				return true;
+			}
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_PROTOREADER_H
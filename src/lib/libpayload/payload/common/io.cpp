@@ -76,6 +76,22 @@ namespace skkk {
 		return ret;
 	}
 
+	int blobPunchHole(int fd, off64_t offset, off64_t length) {
+		int ret = payload_fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+		return ret;
+	}
+
+	bool blobIsHole(int fd, off64_t offset, off64_t length) {
+#if defined(SEEK_DATA)
+		// Filesystems without hole tracking report all of the file as data
+		off64_t dataOffset = payload_lseek(fd, offset, SEEK_DATA);
+		if (dataOffset < 0) return errno == ENXIO;
+		return dataOffset >= offset + length;
+#else
+		return false;
+#endif
+	}
+
 	bool readToString(const std::string &filePath, std::string &result) {
 		int ret = -1, inFd = -1;
 		inFd = openFileRD(filePath);
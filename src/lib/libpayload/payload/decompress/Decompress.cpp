@@ -1,3 +1,14 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <functional>
+#include <memory>
+
 #include <brotli/decode.h>
 #include <bsdiff/bspatch.h>
 #include <bzlib.h>
@@ -5,8 +16,130 @@
 #include <zstd.h>
 
 #include "Decompress.h"
+#include "payload/common/Buffer.hpp"
 
 namespace skkk {
+	class DecoderCounter {
+		public:
+			std::atomic_uint64_t created = 0;
+			std::atomic_uint64_t reused = 0;
+			// Operations decoded by several threads
+			std::atomic_uint64_t parallel = 0;
+	};
+
+	static DecoderCounter bzipCounter, xzCounter, zstdCounter;
+
+	/**
+	 * bzip2 cannot reset a decoder, its state (64K) and block buffer (up to 3.6M) are
+	 * allocated per stream. Freed blocks are kept per thread and handed out again by size.
+	 */
+	class BzipBlockCache {
+		static constexpr uint32_t MaxBlocks = 4;
+		// Size header in front of every block, keeps the alignment of malloc
+		static constexpr uint64_t HeaderSize = alignof(std::max_align_t);
+
+		std::vector<std::pair<uint64_t, void *>> blocks;
+
+		public:
+			~BzipBlockCache() {
+				for (const auto &[size, block]: blocks) {
+					free(block);
+				}
+			}
+
+			void *allocate(uint64_t size) {
+				const auto it = std::ranges::find(blocks, size, &std::pair<uint64_t, void *>::first);
+				void *block;
+				if (it != blocks.end()) {
+					block = it->second;
+					blocks.erase(it);
+					bzipCounter.reused++;
+				} else {
+					block = malloc(HeaderSize + size);
+					if (!block) return nullptr;
+					*static_cast<uint64_t *>(block) = size;
+					bzipCounter.created++;
+				}
+				return static_cast<uint8_t *>(block) + HeaderSize;
+			}
+
+			void release(void *ptr) {
+				if (!ptr) return;
+				void *block = static_cast<uint8_t *>(ptr) - HeaderSize;
+				if (blocks.size() >= MaxBlocks) {
+					free(blocks.front().second);
+					blocks.erase(blocks.begin());
+				}
+				blocks.emplace_back(*static_cast<uint64_t *>(block), block);
+			}
+	};
+
+	static thread_local BzipBlockCache bzipBlockCache;
+
+	static void *bzipAlloc(void *, int items, int size) {
+		return bzipBlockCache.allocate(static_cast<uint64_t>(items) * size);
+	}
+
+	static void bzipFree(void *, void *ptr) {
+		bzipBlockCache.release(ptr);
+	}
+
+	/**
+	 * Initializing a stream decoder again reuses the allocations of the previous one,
+	 * unless the dictionary has to grow. Decoders above MaxKeepSize are released after use.
+	 */
+	class XzDecoder {
+		public:
+			static constexpr uint64_t MaxKeepSize = 16 * 1024 * 1024;
+			lzma_stream strm = LZMA_STREAM_INIT;
+			bool isInitialized = false;
+
+		public:
+			~XzDecoder() {
+				lzma_end(&strm);
+			}
+
+			lzma_ret init(uint64_t memLimit) {
+				(isInitialized ? xzCounter.reused : xzCounter.created)++;
+				const lzma_ret err = lzma_stream_decoder(&strm, memLimit, LZMA_CONCATENATED);
+				isInitialized = err == LZMA_OK;
+				return err;
+			}
+
+			void done() {
+				if (isInitialized && lzma_memusage(&strm) > MaxKeepSize) {
+					lzma_end(&strm);
+					strm = LZMA_STREAM_INIT;
+					isInitialized = false;
+				}
+			}
+	};
+
+	static thread_local XzDecoder xzDecoder;
+
+	/**
+	 * The decompression context of this thread, reset for a new frame.
+	 */
+	static ZSTD_DCtx *getZstdDCtx() {
+		static thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{nullptr, ZSTD_freeDCtx};
+		if (dctx) {
+			ZSTD_DCtx_reset(dctx.get(), ZSTD_reset_session_only);
+			zstdCounter.reused++;
+		} else {
+			dctx.reset(ZSTD_createDCtx());
+			if (dctx) zstdCounter.created++;
+		}
+		return dctx.get();
+	}
+
+	std::string Decompress::contextStats() {
+		return std::format("zstd: {} created, {} reused; xz: {} created, {} reused, {} parallel; "
+		                   "bzip2: {} buffers allocated, {} reused, {} parallel",
+		                   zstdCounter.created.load(), zstdCounter.reused.load(),
+		                   xzCounter.created.load(), xzCounter.reused.load(), xzCounter.parallel.load(),
+		                   bzipCounter.created.load(), bzipCounter.reused.load(), bzipCounter.parallel.load());
+	}
+
 	int Decompress::brotliDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize) {
 		size_t dstSize = destSize;
 		BrotliDecoderResult bret = BrotliDecoderDecompress(srcSize, static_cast<const uint8_t *>(src),
@@ -17,9 +150,12 @@ namespace skkk {
 		return -EBADMSG;
 	}
 
-	int Decompress::bzipDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize) {
+	int Decompress::bzipDecompress(const void *src, uint64_t srcSize, uint8_t *outData,
+	                               const std::vector<Extent> &extents) {
 		int ret = 0;
 		bz_stream strm = {};
+		strm.bzalloc = bzipAlloc;
+		strm.bzfree = bzipFree;
 		int err = BZ2_bzDecompressInit(&strm, 0, 0);
 		if (err != BZ_OK) {
 			ret = -EFAULT;
@@ -27,14 +163,29 @@ namespace skkk {
 		}
 		strm.next_in = const_cast<char *>(static_cast<const char *>(src));
 		strm.avail_in = srcSize;
-		strm.next_out = static_cast<char *>(destBuf);
-		strm.avail_out = destSize;
-		err = BZ2_bzDecompress(&strm);
+		for (const auto &e: extents) {
+			auto *dest = outData + e.dataOffset;
+			uint64_t destSize = e.dataLength;
+			while (destSize > 0) {
+				// avail_out is 32 bits
+				const uint32_t chunkSize = std::min<uint64_t>(destSize, UINT32_MAX);
+				strm.next_out = reinterpret_cast<char *>(dest);
+				strm.avail_out = chunkSize;
+				err = BZ2_bzDecompress(&strm);
+				const uint32_t written = chunkSize - strm.avail_out;
+				dest += written;
+				destSize -= written;
+				if ((err != BZ_OK && err != BZ_STREAM_END) ||
+				    (destSize > 0 && (err == BZ_STREAM_END || (written == 0 && strm.avail_in == 0)))) {
+					ret = -EBADMSG;
+					goto out_bzip_end;
+				}
+			}
+		}
 		if (err != BZ_STREAM_END) {
 			ret = -EBADMSG;
 			goto out_bzip_end;
 		}
-		// destSize = strm.total_out_lo32;
 
 	out_bzip_end:
 		BZ2_bzDecompressEnd(&strm);
@@ -42,39 +193,451 @@ namespace skkk {
 		return ret;
 	}
 
-	int Decompress::xzDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize) {
+	class BzipBlock {
+		public:
+			// From the block magic to the next block or end of stream magic
+			uint64_t bitOffset = 0;
+			uint64_t bitSize = 0;
+			uint32_t crc = 0;
+	};
+
+	static constexpr uint64_t BZIP_BLOCK_MAGIC = 0x314159265359;
+	static constexpr uint64_t BZIP_EOS_MAGIC = 0x177245385090;
+	static constexpr uint64_t BZIP_MAGIC_MASK = 0xFFFFFFFFFFFF;
+
+	/**
+	 * 64 bits at byteOffset, big endian, zero after the end of src
+	 */
+	static uint64_t readBzipBE64(const uint8_t *src, uint64_t srcSize, uint64_t byteOffset) {
+		uint64_t value = 0;
+		for (uint64_t i = byteOffset; i < byteOffset + 8; i++) {
+			value = value << 8 | (i < srcSize ? src[i] : 0);
+		}
+		return value;
+	}
+
+	static uint64_t readBzipBits(const uint8_t *src, uint64_t srcSize, uint64_t bitOffset, uint32_t bitSize) {
+		const uint64_t value = readBzipBE64(src, srcSize, bitOffset / 8) << bitOffset % 8;
+		return value >> (64 - bitSize);
+	}
+
+	/**
+	 * Blocks are bit aligned and only delimited by their 48 bit magic, like lbzip2 and pbzip2 find them.
+	 * A magic inside compressed data splits a block wrongly, the combined CRC check
+	 * or decoding the pieces fails then.
+	 */
+	static bool readBzipBlocks(const uint8_t *src, uint64_t srcSize, std::vector<BzipBlock> &blocks) {
+		if (srcSize < 14 || memcmp(src, "BZh", 3) != 0 || src[3] < '1' || src[3] > '9') return false;
+
+		// The third byte of a magic starting at bit s of a byte is always covered:
+		// its value selects the shifts to check.
+		uint16_t shifts[256] = {};
+		for (uint32_t shift = 0; shift < 8; shift++) {
+			shifts[BZIP_BLOCK_MAGIC >> (24 + shift) & 0xFF] |= 1 << shift;
+			shifts[BZIP_EOS_MAGIC >> (24 + shift) & 0xFF] |= 1 << shift;
+		}
+		// bit offset, is end of stream
+		std::vector<std::pair<uint64_t, bool>> markers;
+		for (uint64_t i = 0; i + 6 < srcSize; i++) {
+			if (const uint16_t mask = shifts[src[i + 2]]) {
+				const uint64_t value = readBzipBE64(src, srcSize, i);
+				for (uint32_t shift = 0; shift < 8; shift++) {
+					if (!(mask & 1 << shift)) continue;
+					const uint64_t magic = value >> (16 - shift) & BZIP_MAGIC_MASK;
+					if (magic == BZIP_BLOCK_MAGIC || magic == BZIP_EOS_MAGIC) {
+						markers.emplace_back(i * 8 + shift, magic == BZIP_EOS_MAGIC);
+					}
+				}
+			}
+		}
+		if (markers.empty() || !markers.back().second) return false;
+
+		uint32_t combinedCrc = 0;
+		for (uint64_t i = 0; i < markers.size(); i++) {
+			const auto &[bitOffset, isEos] = markers[i];
+			const auto crc = static_cast<uint32_t>(readBzipBits(src, srcSize, bitOffset + 48, 32));
+			if (isEos) {
+				// Concatenated streams start over
+				if (crc != combinedCrc) return false;
+				combinedCrc = 0;
+				continue;
+			}
+			auto &block = blocks.emplace_back();
+			block.bitOffset = bitOffset;
+			block.bitSize = markers[i + 1].first - bitOffset;
+			block.crc = crc;
+			combinedCrc = (combinedCrc << 1 | combinedCrc >> 31) ^ crc;
+		}
+		return true;
+	}
+
+	/**
+	 * A block on its own is a valid stream with a header and an end of stream,
+	 * whose combined CRC is the CRC of the block.
+	 * reserve is asked for the growth of output past Decompress::BzipSlotSize before it grows.
+	 */
+	static bool decodeBzipBlock(const uint8_t *src, uint64_t srcSize, const BzipBlock &bzipBlock,
+	                            Buffer<uint8_t> &output, uint64_t &outputSize,
+	                            const std::function<bool(uint64_t size)> &reserve) {
+		const uint64_t blockBytes = (bzipBlock.bitSize + 7) / 8;
+		const uint64_t streamSize = 4 + blockBytes + 11;
+		static thread_local Buffer<uint8_t> stream;
+		if (stream.size() < streamSize) {
+			stream.reserve(streamSize);
+		}
+		auto *data = stream.get();
+		memcpy(data, "BZh9", 4);
+		const uint64_t begin = bzipBlock.bitOffset / 8;
+		const uint32_t shift = bzipBlock.bitOffset % 8;
+		for (uint64_t i = 0; i < blockBytes; i++) {
+			const uint8_t next = shift && begin + i + 1 < srcSize ? src[begin + i + 1] >> (8 - shift) : 0;
+			data[4 + i] = src[begin + i] << shift | next;
+		}
+		uint64_t bitPos = 32 + bzipBlock.bitSize;
+		memset(data + bitPos / 8 + 1, 0, streamSize - bitPos / 8 - 1);
+		data[bitPos / 8] &= 0xFF << (8 - bitPos % 8);
+		const uint64_t tail[2][2] = {{BZIP_EOS_MAGIC, 48}, {bzipBlock.crc, 32}};
+		for (const auto &[value, bits]: tail) {
+			for (uint64_t i = bits; i-- > 0; bitPos++) {
+				data[bitPos / 8] |= (value >> i & 1) << (7 - bitPos % 8);
+			}
+		}
+
+		bz_stream strm = {};
+		strm.bzalloc = bzipAlloc;
+		strm.bzfree = bzipFree;
+		if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) return false;
+		strm.next_in = reinterpret_cast<char *>(data);
+		strm.avail_in = (bitPos + 7) / 8;
+		outputSize = 0;
+		int err = BZ_OK;
+		while (err == BZ_OK) {
+			if (outputSize == output.size()) {
+				// Decoded size is unknown, a block holds at most 900K before the initial RLE
+				const uint64_t largerSize = std::max<uint64_t>(output.size() * 2, Decompress::BzipSlotSize);
+				if (!reserve(largerSize - std::max<uint64_t>(output.size(), Decompress::BzipSlotSize))) {
+					err = BZ_MEM_ERROR;
+					break;
+				}
+				Buffer<uint8_t> larger{largerSize};
+				if (outputSize > 0) memcpy(larger.get(), output.get(), outputSize);
+				output = std::move(larger);
+			}
+			const uint32_t chunkSize = std::min<uint64_t>(output.size() - outputSize, UINT32_MAX);
+			strm.next_out = reinterpret_cast<char *>(output.get() + outputSize);
+			strm.avail_out = chunkSize;
+			err = BZ2_bzDecompress(&strm);
+			outputSize += chunkSize - strm.avail_out;
+			if (err == BZ_OK && strm.avail_in == 0 && strm.avail_out > 0) break;
+		}
+		BZ2_bzDecompressEnd(&strm);
+		return err == BZ_STREAM_END;
+	}
+
+	int Decompress::bzipDecompressBlocks(const void *src, uint64_t srcSize, uint8_t *destBuf, uint64_t destSize,
+	                                     JobPool &pool, uint64_t helperSize) {
+		// Shared with the helper tasks, which may start after this call has returned
+		class State {
+			public:
+				std::vector<BzipBlock> blocks;
+				// One per block of the window, reused by the next windows
+				std::vector<Buffer<uint8_t> > outputs;
+				std::vector<uint64_t> outputSizes;
+				uint64_t windowSize = 0;
+				std::atomic_uint64_t next = 0;
+				// Blocks can be claimed up to end, the current window
+				std::atomic_uint64_t end = 0;
+				std::atomic_uint64_t finished = 0;
+				std::atomic_bool isFailed = false;
+				// Memory budget held for the window, released by the calling thread
+				std::atomic_uint64_t reserved = 0;
+		};
+		// Buffering the blocks costs more than it gains without a helper
+		if (pool.idlCount() == 0) {
+			return -ENOTSUP;
+		}
+		const auto *in = static_cast<const uint8_t *>(src);
+		auto state = std::make_shared<State>();
+		if (!readBzipBlocks(in, srcSize, state->blocks) || state->blocks.size() < 2) {
+			return -ENOTSUP;
+		}
+		const uint64_t blockNum = state->blocks.size();
+		// Decoded blocks are buffered until they are copied in order, a window bounds that memory.
+		// The window and the block copy of this thread are charged to the operation,
+		// the helpers hold their own block copy, see MemoryBudget::helperEstimate.
+		uint64_t windowSize = std::min<uint64_t>(pool.thrCount() * 2, blockNum);
+		for (; windowSize >= 2; windowSize--) {
+			if (pool.tryReserve(windowSize * BzipSlotSize + BzipStreamSize)) break;
+		}
+		if (windowSize < 2) {
+			return -ENOTSUP;
+		}
+		state->reserved = windowSize * BzipSlotSize + BzipStreamSize;
+		state->windowSize = windowSize;
+		state->outputs.resize(windowSize);
+		state->outputSizes.resize(windowSize);
+		auto reserve = [state, &pool](uint64_t size) {
+			if (size == 0) return true;
+			if (!pool.tryReserve(size)) return false;
+			state->reserved += size;
+			return true;
+		};
+		auto decodeBlocks = [state, in, srcSize, reserve] {
+			while (true) {
+				uint64_t i = state->next;
+				do {
+					if (i >= state->end) return;
+				} while (!state->next.compare_exchange_weak(i, i + 1));
+				const uint64_t slot = i % state->windowSize;
+				if (!state->isFailed && !decodeBzipBlock(in, srcSize, state->blocks[i],
+				                                         state->outputs[slot], state->outputSizes[slot], reserve)) {
+					state->isFailed = true;
+				}
+				++state->finished;
+				state->finished.notify_all();
+			}
+		};
+		uint64_t destOffset = 0;
+		for (uint64_t begin = 0; begin < blockNum && !state->isFailed; begin += windowSize) {
+			const uint64_t end = std::min(blockNum, begin + windowSize);
+			state->end = end;
+			pool.commitHelpers(std::min<uint64_t>(pool.idlCount(), end - begin - 1), helperSize, decodeBlocks);
+			decodeBlocks();
+			for (uint64_t finished; (finished = state->finished) < end;) {
+				state->finished.wait(finished);
+			}
+			for (uint64_t i = begin; i < end && !state->isFailed; i++) {
+				const uint64_t slot = i % windowSize;
+				const uint64_t size = state->outputSizes[slot];
+				if (destOffset + size > destSize) {
+					state->isFailed = true;
+					break;
+				}
+				memcpy(destBuf + destOffset, state->outputs[slot].get(), size);
+				destOffset += size;
+			}
+		}
+		// Late helpers find no block to claim, the window is not used any more
+		state->outputs.clear();
+		pool.release(state->reserved);
+		if (state->isFailed || destOffset != destSize) {
+			return -ENOTSUP;
+		}
+		bzipCounter.parallel++;
+		return 0;
+	}
+
+	int Decompress::xzDecompress(const void *src, uint64_t srcSize, uint8_t *outData,
+	                             const std::vector<Extent> &extents) {
 		int ret = 0;
-		lzma_stream strm = LZMA_STREAM_INIT;
-		lzma_ret err = lzma_stream_decoder(&strm, MaxDictSize, LZMA_CONCATENATED);
+		lzma_stream &strm = xzDecoder.strm;
+		lzma_ret err = xzDecoder.init(MaxDictSize);
 		if (err != LZMA_OK) {
 			ret = -EFAULT;
 			goto out;
 		}
 		strm.next_in = static_cast<const uint8_t *>(src);
 		strm.avail_in = srcSize;
-		strm.next_out = static_cast<uint8_t *>(destBuf);
-		strm.avail_out = destSize;
-		err = lzma_code(&strm, LZMA_FINISH);
+		for (const auto &e: extents) {
+			strm.next_out = outData + e.dataOffset;
+			strm.avail_out = e.dataLength;
+			while (strm.avail_out > 0 && err == LZMA_OK) {
+				err = lzma_code(&strm, LZMA_FINISH);
+			}
+			if (strm.avail_out > 0) {
+				ret = -EBADMSG;
+				goto out_lzma_end;
+			}
+		}
+		if (err == LZMA_OK) {
+			// The output is complete, the index and footer may still be left
+			err = lzma_code(&strm, LZMA_FINISH);
+		}
 		if (err != LZMA_STREAM_END) {
 			ret = -EBADMSG;
 			goto out_lzma_end;
 		}
-		destSize = strm.total_out;
 
 	out_lzma_end:
-		lzma_end(&strm);
+		xzDecoder.done();
 	out:
 		return ret;
 	}
 
-	int Decompress::zstdDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize) {
+	class XzBlock {
+		public:
+			// Offset and size in the stream, from the block header to the check
+			uint64_t inOffset = 0;
+			uint64_t inSize = 0;
+			uint64_t unpaddedSize = 0;
+			uint64_t outOffset = 0;
+			uint64_t outSize = 0;
+	};
+
+	/**
+	 * The stream must start at src and fill it, except stream padding,
+	 * and its blocks must fill destSize.
+	 */
+	static bool readXzBlocks(const uint8_t *src, uint64_t srcSize, uint64_t destSize,
+	                         lzma_check &check, std::vector<XzBlock> &blocks) {
+		uint64_t end = srcSize;
+		while (end >= 4 && src[end - 1] == 0 && src[end - 2] == 0 && src[end - 3] == 0 && src[end - 4] == 0) {
+			end -= 4;
+		}
+		if (end < LZMA_STREAM_HEADER_SIZE * 2) return false;
+
+		lzma_stream_flags header, footer;
+		if (lzma_stream_header_decode(&header, src) != LZMA_OK ||
+		    lzma_stream_footer_decode(&footer, src + end - LZMA_STREAM_HEADER_SIZE) != LZMA_OK ||
+		    lzma_stream_flags_compare(&header, &footer) != LZMA_OK) {
+			return false;
+		}
+		const uint64_t indexEnd = end - LZMA_STREAM_HEADER_SIZE;
+		if (footer.backward_size > indexEnd - LZMA_STREAM_HEADER_SIZE) return false;
+		const uint64_t indexStart = indexEnd - footer.backward_size;
+
+		lzma_index *index = nullptr;
+		uint64_t memLimit = UINT64_MAX;
+		size_t inPos = indexStart;
+		if (lzma_index_buffer_decode(&index, &memLimit, nullptr, src, &inPos, indexEnd) != LZMA_OK) {
+			return false;
+		}
+		bool ret = LZMA_STREAM_HEADER_SIZE + lzma_index_total_size(index) == indexStart &&
+		           lzma_index_uncompressed_size(index) == destSize;
+		if (ret) {
+			lzma_index_iter iter;
+			lzma_index_iter_init(&iter, index);
+			while (!lzma_index_iter_next(&iter, LZMA_INDEX_ITER_NONEMPTY_BLOCK)) {
+				auto &block = blocks.emplace_back();
+				block.inOffset = iter.block.compressed_stream_offset;
+				block.inSize = iter.block.total_size;
+				block.unpaddedSize = iter.block.unpadded_size;
+				block.outOffset = iter.block.uncompressed_stream_offset;
+				block.outSize = iter.block.uncompressed_size;
+			}
+			check = header.check;
+		}
+		lzma_index_end(index, nullptr);
+		return ret;
+	}
+
+	/**
+	 * -EBADMSG if the block decodes to its full size but fails its check,
+	 * -ENOTSUP for any other failure, the stream decoder reports that one.
+	 */
+	static int decodeXzBlock(const uint8_t *src, lzma_check check, const XzBlock &xzBlock, uint8_t *destBuf) {
+		lzma_filter filters[LZMA_FILTERS_MAX + 1];
+		lzma_block block = {};
+		block.version = 1;
+		block.check = check;
+		block.filters = filters;
+		block.header_size = lzma_block_header_size_decode(src[xzBlock.inOffset]);
+		if (block.header_size > xzBlock.inSize ||
+		    lzma_block_header_decode(&block, nullptr, src + xzBlock.inOffset) != LZMA_OK) {
+			return -ENOTSUP;
+		}
+		int ret = -ENOTSUP;
+		if (lzma_block_compressed_size(&block, xzBlock.unpaddedSize) == LZMA_OK) {
+			size_t inPos = xzBlock.inOffset + block.header_size;
+			size_t outPos = 0;
+			const lzma_ret err = lzma_block_buffer_decode(&block, nullptr, src, &inPos,
+			                                              xzBlock.inOffset + xzBlock.inSize,
+			                                              destBuf + xzBlock.outOffset, &outPos, xzBlock.outSize);
+			if (outPos == xzBlock.outSize) {
+				// The check follows the data, a data error after the whole block is a check mismatch
+				ret = err == LZMA_OK ? 0 : err == LZMA_DATA_ERROR ? -EBADMSG : -ENOTSUP;
+			}
+		}
+		for (uint32_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++) {
+			free(filters[i].options);
+		}
+		return ret;
+	}
+
+	int Decompress::xzDecompressBlocks(const void *src, uint64_t srcSize, uint8_t *destBuf, uint64_t destSize,
+	                                   JobPool &pool, uint64_t helperSize) {
+		// Shared with the helper tasks, which may start after this call has returned
+		class State {
+			public:
+				std::vector<XzBlock> blocks;
+				lzma_check check = LZMA_CHECK_NONE;
+				std::atomic_uint64_t next = 0;
+				std::atomic_uint64_t finished = 0;
+				std::atomic_bool isFailed = false;
+				// A block failed its check, the other failures fall back to the stream decoder
+				std::atomic_bool isBadCheck = false;
+		};
+		const auto *in = static_cast<const uint8_t *>(src);
+		auto state = std::make_shared<State>();
+		if (!readXzBlocks(in, srcSize, destSize, state->check, state->blocks) || state->blocks.size() < 2) {
+			return -ENOTSUP;
+		}
+		// in and destBuf are only used for claimed blocks, which finish before this call returns
+		auto decodeBlocks = [state, in, destBuf] {
+			const uint64_t blockNum = state->blocks.size();
+			for (uint64_t i; (i = state->next++) < blockNum;) {
+				if (!state->isFailed) {
+					const int ret = decodeXzBlock(in, state->check, state->blocks[i], destBuf);
+					if (ret == -EBADMSG) state->isBadCheck = true;
+					if (ret) state->isFailed = true;
+				}
+				if (++state->finished == blockNum) {
+					state->finished.notify_all();
+				}
+			}
+		};
+		pool.commitHelpers(std::min<uint64_t>(pool.idlCount(), state->blocks.size() - 1), helperSize, decodeBlocks);
+		decodeBlocks();
+		for (uint64_t finished; (finished = state->finished) < state->blocks.size();) {
+			state->finished.wait(finished);
+		}
+		if (state->isFailed) {
+			return state->isBadCheck ? -EBADMSG : -ENOTSUP;
+		}
+		xzCounter.parallel++;
+		return 0;
+	}
+
+	int Decompress::zstdDecompress(const void *src, uint64_t srcSize, uint8_t *outData,
+	                               const std::vector<Extent> &extents) {
 		int ret = 0;
-		ret = ZSTD_decompress(destBuf, destSize, src, srcSize);
-		if (ZSTD_isError(ret)) {
-			ret = -EBADMSG;
+		size_t err = 0;
+		ZSTD_inBuffer input{src, srcSize, 0};
+		ZSTD_outBuffer end{nullptr, 0, 0};
+		ZSTD_DCtx *dctx = getZstdDCtx();
+		if (!dctx) {
+			ret = -ENOMEM;
 			goto out;
 		}
-		ret = 0;
+		if (extents.size() == 1) {
+			auto &e = extents[0];
+			err = ZSTD_decompressDCtx(dctx, outData + e.dataOffset, e.dataLength, src, srcSize);
+			if (ZSTD_isError(err) || err != e.dataLength) {
+				ret = -EBADMSG;
+			}
+			goto out;
+		}
+		for (const auto &e: extents) {
+			ZSTD_outBuffer output{outData + e.dataOffset, e.dataLength, 0};
+			while (output.pos < output.size) {
+				const size_t lastIn = input.pos, lastOut = output.pos;
+				err = ZSTD_decompressStream(dctx, &output, &input);
+				if (ZSTD_isError(err) || (input.pos == lastIn && output.pos == lastOut)) {
+					ret = -EBADMSG;
+					goto out;
+				}
+			}
+		}
+		// Nothing may be left after the last extent
+		while (err != 0 || input.pos < input.size) {
+			const size_t lastIn = input.pos;
+			err = ZSTD_decompressStream(dctx, &end, &input);
+			if (ZSTD_isError(err) || (err != 0 && input.pos == lastIn)) {
+				ret = -EBADMSG;
+				goto out;
+			}
+		}
+
 	out:
 		return ret;
 	}
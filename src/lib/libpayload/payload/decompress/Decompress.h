@@ -2,19 +2,61 @@
 #define PAYLOAD_EXTRACT_DECOMPRESS_H
 
 #include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "payload/PartitionInfo.h"
+#include "payload/JobPool.h"
 
 namespace skkk {
+	/**
+	 * The streaming decoders write to outData + extent.dataOffset, one extent after another,
+	 * the output has to fill the extents exactly.
+	 * Every thread keeps its zstd context, xz decoder and bzip2 buffers for the next operation.
+	 */
 	class Decompress {
 		static constexpr uint32_t MaxDictSize = 64 * 1024 * 1024;
 
 		public:
+			// Buffer of a decoded bzip2 block, doubled while the initial RLE makes the block larger
+			static constexpr uint64_t BzipSlotSize = 4 * 1024 * 1024;
+			// Copy of a single bzip2 block, a block compresses to at most about 900K
+			static constexpr uint64_t BzipStreamSize = 1024 * 1024;
+
 			static int brotliDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize);
 
-			static int bzipDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize);
+			static int bzipDecompress(const void *src, uint64_t srcSize, uint8_t *outData,
+			                          const std::vector<Extent> &extents);
+
+			/**
+			 * Same as xzDecompressBlocks for bzip2, the blocks are found by their magic.
+			 * The window of decoded blocks is reserved in the memory budget of pool and shrinks to fit.
+			 * -ENOTSUP if the stream cannot be split, a block fails or the budget has no room for
+			 * the window, decode it as one stream then.
+			 */
+			static int bzipDecompressBlocks(const void *src, uint64_t srcSize, uint8_t *destBuf, uint64_t destSize,
+			                                JobPool &pool, uint64_t helperSize);
+
+			static int xzDecompress(const void *src, uint64_t srcSize, uint8_t *outData,
+			                        const std::vector<Extent> &extents);
+
+			/**
+			 * Decodes the blocks of a single xz stream in parallel, from the index at its end.
+			 * The calling thread decodes blocks as well, idle workers of pool help with the rest,
+			 * so it never waits for a busy pool. -ENOTSUP if the stream cannot be split or a block
+			 * fails to decode, decode it as one stream then. -EBADMSG if a block fails its check.
+			 * helperSize: memory budget held by every helper, see MemoryBudget::helperEstimate.
+			 */
+			static int xzDecompressBlocks(const void *src, uint64_t srcSize, uint8_t *destBuf, uint64_t destSize,
+			                              JobPool &pool, uint64_t helperSize);
 
-			static int xzDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize);
+			static int zstdDecompress(const void *src, uint64_t srcSize, uint8_t *outData,
+			                          const std::vector<Extent> &extents);
 
-			static int zstdDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize);
+			/**
+			 * Decoder contexts created and reused so far, by all threads
+			 */
+			static std::string contextStats();
 	};
 }
 
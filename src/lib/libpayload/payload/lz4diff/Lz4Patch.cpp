@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <bsdiff/bspatch.h>
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include "Lz4Patch.h"
+#include "common/ProtoReader.h"
+#include "payload/common/Buffer.hpp"
+#include "payload/verify/VerifyInfo.h"
+#include "puffpatch/PuffPatch.h"
+#include "verify/sha256Utils.h"
+
+namespace skkk {
+	static constexpr char LZ4DIFF_MAGIC[] = "LZ4DIFF";
+	static constexpr uint32_t LZ4DIFF_MAGIC_SIZE = 7;
+	static constexpr uint32_t LZ4DIFF_VERSION = 1;
+	// EROFS zero padding sits in front of the compressed data, within the first block
+	static constexpr uint64_t LZ4_PADDING_BLOCK_SIZE = 4096;
+
+	enum Lz4InnerPatchType : uint64_t {
+		INNER_BSDIFF = 0,
+		INNER_PUFFDIFF = 1,
+	};
+
+	enum Lz4CompressionType : uint64_t {
+		COMPRESSION_UNCOMPRESSED = 0,
+		COMPRESSION_LZ4 = 1,
+		COMPRESSION_LZ4HC = 2,
+	};
+
+	class Lz4Block {
+		public:
+			uint64_t uncompressedOffset = 0;
+			uint64_t uncompressedLength = 0;
+			uint64_t compressedLength = 0;
+			// Of the compressed block before the postfix patch, empty if not checked
+			const uint8_t *sha256Hash = nullptr;
+			uint64_t sha256HashSize = 0;
+			// bsdiff patch fixing a block the compressor doesn't reproduce
+			const uint8_t *postfixPatch = nullptr;
+			uint64_t postfixPatchSize = 0;
+
+		public:
+			// Blocks that don't get smaller are stored
+			bool isCompressed() const { return compressedLength < uncompressedLength; }
+	};
+
+	class Lz4CompressedFile {
+		public:
+			std::vector<Lz4Block> blocks;
+			uint64_t algorithm = COMPRESSION_UNCOMPRESSED;
+			uint64_t level = 0;
+			bool zeroPadding = false;
+			uint64_t compressedSize = 0;
+			uint64_t uncompressedSize = 0;
+	};
+
+	class Lz4diffHeader {
+		public:
+			Lz4CompressedFile src;
+			Lz4CompressedFile dst;
+			uint64_t innerType = INNER_BSDIFF;
+	};
+
+	// message CompressedBlockInfo { uint64 uncompressed_offset = 1; uint64 uncompressed_length = 2;
+	//                               uint64 compressed_length = 3; bytes sha256_hash = 4; bytes postfix_bspatch = 5; }
+	static bool parseBlock(ProtoReader reader, Lz4Block &block) {
+		while (reader.hasData()) {
+			uint32_t field, wireType;
+			if (!reader.readField(field, wireType)) return false;
+			ProtoReader bytes{nullptr, 0};
+			bool isOk;
+			if (field == 1 && wireType == 0) {
+				isOk = reader.readVarint(block.uncompressedOffset);
+			} else if (field == 2 && wireType == 0) {
+				isOk = reader.readVarint(block.uncompressedLength);
+			} else if (field == 3 && wireType == 0) {
+				isOk = reader.readVarint(block.compressedLength);
+			} else if (field == 4 && wireType == 2) {
+				isOk = reader.readMessage(bytes);
+				block.sha256Hash = bytes.get();
+				block.sha256HashSize = bytes.size();
+			} else if (field == 5 && wireType == 2) {
+				isOk = reader.readMessage(bytes);
+				block.postfixPatch = bytes.get();
+				block.postfixPatchSize = bytes.size();
+			} else {
+				isOk = reader.skip(wireType);
+			}
+			if (!isOk) return false;
+		}
+		// lz4 takes int sizes
+		return block.uncompressedLength <= INT_MAX && block.compressedLength <= INT_MAX &&
+		       (block.isCompressed() || block.compressedLength == block.uncompressedLength) &&
+		       (!block.sha256HashSize || block.sha256HashSize == SHA256_DIGEST_SIZE);
+	}
+
+	// message CompressionAlgorithm { Type type = 1; uint32 level = 2; }
+	static bool parseAlgorithm(ProtoReader reader, Lz4CompressedFile &file) {
+		while (reader.hasData()) {
+			uint32_t field, wireType;
+			if (!reader.readField(field, wireType)) return false;
+			bool isOk;
+			if (field == 1 && wireType == 0) {
+				isOk = reader.readVarint(file.algorithm);
+			} else if (field == 2 && wireType == 0) {
+				isOk = reader.readVarint(file.level);
+			} else {
+				isOk = reader.skip(wireType);
+			}
+			if (!isOk) return false;
+		}
+		return file.level <= INT_MAX;
+	}
+
+	// message CompressedFile { repeated CompressedBlockInfo block_info = 1; CompressionAlgorithm algo = 2;
+	//                          bool zero_padding_enabled = 3; }
+	static bool parseCompressedFile(ProtoReader reader, Lz4CompressedFile &file) {
+		while (reader.hasData()) {
+			uint32_t field, wireType;
+			if (!reader.readField(field, wireType)) return false;
+			ProtoReader message{nullptr, 0};
+			uint64_t value;
+			bool isOk;
+			if (field == 1 && wireType == 2) {
+				isOk = reader.readMessage(message) && parseBlock(message, file.blocks.emplace_back());
+			} else if (field == 2 && wireType == 2) {
+				isOk = reader.readMessage(message) && parseAlgorithm(message, file);
+			} else if (field == 3 && wireType == 0) {
+				isOk = reader.readVarint(value);
+				file.zeroPadding = value != 0;
+			} else {
+				isOk = reader.skip(wireType);
+			}
+			if (!isOk) return false;
+		}
+		// Blocks are decompressed one after another
+		for (const auto &block: file.blocks) {
+			if (block.uncompressedOffset != file.uncompressedSize) return false;
+			file.compressedSize += block.compressedLength;
+			file.uncompressedSize += block.uncompressedLength;
+		}
+		return true;
+	}
+
+	// message Lz4diffHeader { CompressedFile src_info = 1; CompressedFile dst_info = 2; InnerPatchType inner_type = 3; }
+	static bool parseHeader(ProtoReader reader, Lz4diffHeader &header) {
+		while (reader.hasData()) {
+			uint32_t field, wireType;
+			if (!reader.readField(field, wireType)) return false;
+			ProtoReader message{nullptr, 0};
+			bool isOk;
+			if ((field == 1 || field == 2) && wireType == 2) {
+				isOk = reader.readMessage(message) &&
+				       parseCompressedFile(message, field == 1 ? header.src : header.dst);
+			} else if (field == 3 && wireType == 0) {
+				isOk = reader.readVarint(header.innerType);
+			} else {
+				isOk = reader.skip(wireType);
+			}
+			if (!isOk) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * The lz4hc state of this thread, initialized again by every compression.
+	 */
+	static LZ4_streamHC_t *getLz4HcState() {
+		static thread_local std::unique_ptr<LZ4_streamHC_t, decltype(&LZ4_freeStreamHC)> state{nullptr, LZ4_freeStreamHC};
+		if (!state) {
+			state.reset(LZ4_createStreamHC());
+		}
+		return state.get();
+	}
+
+	/**
+	 * Decompresses the blocks of data into out, data behind the last block is copied as it is.
+	 */
+	static bool decompressBlocks(const uint8_t *data, const Lz4CompressedFile &file, uint8_t *out, uint64_t outSize) {
+		uint64_t dataPos = 0, outPos = 0;
+		for (const auto &block: file.blocks) {
+			const uint8_t *cluster = data + dataPos;
+			if (!block.isCompressed()) {
+				memcpy(out + outPos, cluster, block.compressedLength);
+			} else {
+				uint64_t margin = 0;
+				if (file.zeroPadding) {
+					const uint64_t maxMargin = std::min(LZ4_PADDING_BLOCK_SIZE, block.compressedLength);
+					while (margin < maxMargin && cluster[margin] == 0) margin++;
+				}
+				const int size = LZ4_decompress_safe_partial(reinterpret_cast<const char *>(cluster + margin),
+				                                             reinterpret_cast<char *>(out + outPos),
+				                                             static_cast<int>(block.compressedLength - margin),
+				                                             static_cast<int>(block.uncompressedLength),
+				                                             static_cast<int>(block.uncompressedLength));
+				if (size < 0 || static_cast<uint64_t>(size) != block.uncompressedLength) return false;
+			}
+			dataPos += block.compressedLength;
+			outPos += block.uncompressedLength;
+		}
+		memcpy(out + outPos, data + dataPos, outSize - outPos);
+		return true;
+	}
+
+	/**
+	 * Compresses one block of data into out, padded with zeros to its compressed length.
+	 */
+	static int compressBlock(const uint8_t *data, const Lz4CompressedFile &file, const Lz4Block &block,
+	                         uint8_t *out) {
+		const uint8_t *in = data + block.uncompressedOffset;
+		if (!block.isCompressed()) {
+			memcpy(out, in, block.compressedLength);
+			return 0;
+		}
+		// Given more input than the block holds, the compressor doesn't end the block early
+		int inSize = static_cast<int>(std::min<uint64_t>(file.uncompressedSize - block.uncompressedOffset, INT_MAX));
+		const int outSize = static_cast<int>(block.compressedLength);
+		int written;
+		switch (file.algorithm) {
+			case COMPRESSION_LZ4HC:
+				written = LZ4_compress_HC_destSize(getLz4HcState(), reinterpret_cast<const char *>(in),
+				                                   reinterpret_cast<char *>(out), &inSize, outSize,
+				                                   static_cast<int>(file.level));
+				break;
+			case COMPRESSION_LZ4:
+				written = LZ4_compress_destSize(reinterpret_cast<const char *>(in), reinterpret_cast<char *>(out),
+				                                &inSize, outSize);
+				break;
+			default:
+				return -ENOTSUP;
+		}
+		if (written <= 0 || written > outSize) return -EBADMSG;
+		const uint64_t padding = outSize - written;
+		if (file.zeroPadding) {
+			memmove(out + padding, out, written);
+			memset(out, 0, padding);
+		} else {
+			memset(out + written, 0, padding);
+		}
+		return 0;
+	}
+
+	/**
+	 * Compresses the blocks of data into out, checks them and applies their postfix patches.
+	 * Data behind the last block is copied as it is.
+	 */
+	static int compressBlocks(const uint8_t *data, const Lz4CompressedFile &file, uint8_t *out, uint64_t outSize) {
+		static thread_local Buffer<uint8_t> fixBuffer;
+		uint64_t outPos = 0;
+		for (const auto &block: file.blocks) {
+			// Blocks with a postfix patch are compressed aside and patched into out
+			uint8_t *blockData = out + outPos;
+			if (block.postfixPatchSize) {
+				if (fixBuffer.size() < block.compressedLength) {
+					fixBuffer.reserve(block.compressedLength);
+				}
+				blockData = fixBuffer.get();
+			}
+			int ret = compressBlock(data, file, block, blockData);
+			if (ret) return ret;
+
+			if (block.sha256HashSize) {
+				uint8_t hash[SHA256_DIGEST_SIZE];
+				if (!sha256(blockData, block.compressedLength, hash) ||
+				    !sha256Equal(hash, block.sha256Hash, SHA256_DIGEST_SIZE)) {
+					return -EBADMSG;
+				}
+			}
+			if (block.postfixPatchSize) {
+				uint64_t patchedSize = 0;
+				auto sink = [out, outPos, &patchedSize, &block](const uint8_t *patched, size_t len) -> size_t {
+					if (patchedSize + len > block.compressedLength) return 0;
+					memcpy(out + outPos + patchedSize, patched, len);
+					patchedSize += len;
+					return len;
+				};
+				if (bsdiff::bspatch(blockData, block.compressedLength, block.postfixPatch, block.postfixPatchSize,
+				                    sink) || patchedSize != block.compressedLength) {
+					return -EBADMSG;
+				}
+			}
+			outPos += block.compressedLength;
+		}
+		memcpy(out + outPos, data + file.uncompressedSize, outSize - outPos);
+		return 0;
+	}
+
+	int Lz4Patch::apply(const uint8_t *src, uint64_t srcSize, const uint8_t *patch, uint64_t patchSize,
+	                    uint8_t *dest, uint64_t destSize) {
+		const uint64_t headerOffset = LZ4DIFF_MAGIC_SIZE + 8ULL;
+		if (patchSize < headerOffset || memcmp(patch, LZ4DIFF_MAGIC, LZ4DIFF_MAGIC_SIZE) != 0) {
+			return -EBADMSG;
+		}
+		const uint8_t *sizeData = patch + LZ4DIFF_MAGIC_SIZE;
+		const uint32_t version = sizeData[0] << 24 | sizeData[1] << 16 | sizeData[2] << 8 | sizeData[3];
+		const uint32_t headerSize = sizeData[4] << 24 | sizeData[5] << 16 | sizeData[6] << 8 | sizeData[7];
+		const uint64_t innerOffset = headerOffset + headerSize;
+		if (version != LZ4DIFF_VERSION || innerOffset > patchSize) return -EBADMSG;
+
+		Lz4diffHeader header;
+		if (!parseHeader(ProtoReader{patch + headerOffset, headerSize}, header)) return -EBADMSG;
+		if (header.innerType != INNER_BSDIFF && header.innerType != INNER_PUFFDIFF) return -ENOTSUP;
+		if (header.dst.algorithm != COMPRESSION_LZ4 && header.dst.algorithm != COMPRESSION_LZ4HC &&
+		    std::ranges::any_of(header.dst.blocks, &Lz4Block::isCompressed)) {
+			return -ENOTSUP;
+		}
+		if (header.src.compressedSize > srcSize || header.dst.compressedSize > destSize) return -EBADMSG;
+
+		const uint64_t srcDecodedSize = header.src.uncompressedSize + srcSize - header.src.compressedSize;
+		const uint64_t dstDecodedSize = header.dst.uncompressedSize + destSize - header.dst.compressedSize;
+		Buffer<uint8_t> srcDecoded{srcDecodedSize};
+		if (!decompressBlocks(src, header.src, srcDecoded.get(), srcDecodedSize)) return -EBADMSG;
+
+		Buffer<uint8_t> dstDecoded{dstDecodedSize};
+		const uint8_t *innerPatch = patch + innerOffset;
+		const uint64_t innerPatchSize = patchSize - innerOffset;
+		if (header.innerType == INNER_PUFFDIFF) {
+			const int ret = PuffPatch::apply(srcDecoded.get(), srcDecodedSize, innerPatch, innerPatchSize,
+			                                 dstDecoded.get(), dstDecodedSize);
+			if (ret) return ret;
+		} else {
+			uint64_t patchedSize = 0;
+			auto sink = [&dstDecoded, &patchedSize, dstDecodedSize](const uint8_t *data, size_t len) -> size_t {
+				if (patchedSize + len > dstDecodedSize) return 0;
+				memcpy(dstDecoded.get() + patchedSize, data, len);
+				patchedSize += len;
+				return len;
+			};
+			if (bsdiff::bspatch(srcDecoded.get(), srcDecodedSize, innerPatch, innerPatchSize, sink) ||
+			    patchedSize != dstDecodedSize) {
+				return -EBADMSG;
+			}
+		}
+		srcDecoded = Buffer<uint8_t>{};
+
+		return compressBlocks(dstDecoded.get(), header.dst, dest, destSize);
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef PAYLOAD_EXTRACT_LZ4PATCH_H
+#define PAYLOAD_EXTRACT_LZ4PATCH_H
+
+#include <cinttypes>
+
+namespace skkk {
+	/**
+	 * Applies an lz4diff patch: "LZ4DIFF", the version and header size (u32 BE),
+	 * the Lz4diffHeader protobuf with the lz4 blocks of both sides, then the inner bsdiff or puffdiff patch.
+	 * The src blocks are decompressed, patched, and the result compressed again into the dst blocks
+	 * with the algorithm of the header, a block the compressor can't reproduce carries a bsdiff fix-up.
+	 * The lz4hc state is kept per thread.
+	 */
+	class Lz4Patch {
+		public:
+			/**
+			 * -EBADMSG for a broken patch, lz4 block or a block hash mismatch,
+			 * -ENOTSUP for an unknown compression algorithm.
+			 */
+			static int apply(const uint8_t *src, uint64_t srcSize, const uint8_t *patch, uint64_t patchSize,
+			                 uint8_t *dest, uint64_t destSize);
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_LZ4PATCH_H
@@ -0,0 +1,683 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "Puff.h"
+
+namespace skkk {
+	static constexpr uint16_t LENGTH_BASES[29] = {
+		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+	};
+	static constexpr uint8_t LENGTH_EXTRA_BITS[29] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+	};
+	static constexpr uint16_t DISTANCE_BASES[30] = {
+		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+	};
+	static constexpr uint8_t DISTANCE_EXTRA_BITS[30] = {
+		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+	};
+	// Order of the code length code lengths in a dynamic block header
+	static constexpr uint8_t CODE_LENGTH_ORDER[19] = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+	};
+
+	static constexpr uint32_t MAX_CODE_BITS = 15;
+	static constexpr uint32_t FIXED_LIT_LEN_CODES = 288;
+	static constexpr uint32_t MAX_LIT_LEN_CODES = 286;
+	static constexpr uint32_t MAX_DISTANCE_CODES = 30;
+	static constexpr uint16_t END_OF_BLOCK = 256;
+	// Longest literals entry, longer runs are split
+	static constexpr uint32_t MAX_LITERALS_LENGTH = (1 << 16) + 127;
+	// Block header, counts, code length code lengths and the run length coded code lengths
+	static constexpr uint32_t MAX_METADATA_SIZE = 1 + 3 + 10 + MAX_LIT_LEN_CODES + MAX_DISTANCE_CODES;
+
+	enum BlockType : uint8_t {
+		BLOCK_UNCOMPRESSED = 0,
+		BLOCK_FIXED = 1,
+		BLOCK_DYNAMIC = 2,
+	};
+
+	static uint16_t readBE16(const uint8_t *data) {
+		return data[0] << 8 | data[1];
+	}
+
+	static void writeBE16(uint8_t *data, uint16_t value) {
+		data[0] = value >> 8;
+		data[1] = value;
+	}
+
+	/**
+	 * Deflate bits, lowest bit first. Bits past the end read as zero and mark the reader overrun.
+	 */
+	class DeflateReader {
+		const uint8_t *data;
+		uint64_t pos;
+		uint64_t end;
+
+		public:
+			DeflateReader(const uint8_t *data, uint64_t bitOffset, uint64_t bitEnd)
+				: data(data), pos(bitOffset), end(bitEnd) {
+			}
+
+			// Up to 32 bits
+			uint32_t peek(uint32_t n) const {
+				if (pos >= end) return 0;
+				const uint64_t bytePos = pos / 8;
+				const uint64_t byteNum = std::min<uint64_t>(8, (end + 7) / 8 - bytePos);
+				uint64_t word = 0;
+				for (uint64_t i = 0; i < byteNum; i++) {
+					word |= static_cast<uint64_t>(data[bytePos + i]) << (i * 8);
+				}
+				word >>= pos % 8;
+				n = std::min<uint64_t>(n, end - pos);
+				return word & ((1ULL << n) - 1);
+			}
+
+			void drop(uint32_t n) { pos += n; }
+
+			uint32_t read(uint32_t n) {
+				const uint32_t value = peek(n);
+				pos += n;
+				return value;
+			}
+
+			// Stored block data, the reader is at a byte boundary
+			const uint8_t *readBytes(uint64_t length) {
+				if (pos % 8 || pos + length * 8 > end) return nullptr;
+				const uint8_t *bytes = data + pos / 8;
+				pos += length * 8;
+				return bytes;
+			}
+
+			uint64_t position() const { return pos; }
+
+			uint64_t remaining() const { return pos < end ? end - pos : 0; }
+
+			bool isOverrun() const { return pos > end; }
+	};
+
+	/**
+	 * Deflate bits from a bit offset of out, lowest bit first.
+	 */
+	class DeflateWriter {
+		uint8_t *out;
+		uint64_t size;
+		uint64_t pos;
+		uint64_t bits;
+		uint32_t bitCount;
+		bool isFailed = false;
+
+		public:
+			DeflateWriter(uint8_t *out, uint64_t size, uint64_t bitOffset)
+				: out(out), size(size), pos(bitOffset / 8), bitCount(bitOffset % 8) {
+				// The bits below the offset belong to the data in front
+				bits = bitCount && pos < size ? out[pos] & ((1U << bitCount) - 1) : 0;
+			}
+
+			// Up to 32 bits
+			void write(uint32_t n, uint32_t value) {
+				bits |= static_cast<uint64_t>(value) << bitCount;
+				bitCount += n;
+				while (bitCount >= 8) {
+					if (pos >= size) {
+						isFailed = true;
+						return;
+					}
+					out[pos++] = bits;
+					bits >>= 8;
+					bitCount -= 8;
+				}
+			}
+
+			void writeBytes(const uint8_t *data, uint64_t length) {
+				if (bitCount || pos + length > size) {
+					isFailed = true;
+					return;
+				}
+				memcpy(out + pos, data, length);
+				pos += length;
+			}
+
+			uint64_t position() const { return pos * 8 + bitCount; }
+
+			// Writes the last partial byte, its bits above the position are zero
+			bool finish() {
+				if (bitCount) {
+					if (pos >= size) return false;
+					out[pos] = bits;
+				}
+				return !isFailed;
+			}
+	};
+
+	static uint16_t reverseBits(uint16_t code, uint32_t length) {
+		uint16_t reversed = 0;
+		for (uint32_t i = 0; i < length; i++) {
+			reversed = reversed << 1 | (code & 1);
+			code >>= 1;
+		}
+		return reversed;
+	}
+
+	/**
+	 * Canonical Huffman code of a deflate alphabet. Deflate stores a code from its first bit
+	 * in the lowest bit, codes are decoded by a table of all maxBits wide bit patterns.
+	 */
+	class HuffmanCode {
+		// symbol << 4 | code length, 0 if no code matches the pattern
+		std::vector<uint16_t> table;
+		std::array<uint16_t, FIXED_LIT_LEN_CODES> codes{};
+		std::array<uint8_t, FIXED_LIT_LEN_CODES> lengths{};
+		uint32_t maxBits = 0;
+
+		public:
+			bool build(const uint8_t *codeLengths, uint32_t num, bool forDecode) {
+				std::array<uint16_t, MAX_CODE_BITS + 1> count{};
+				for (uint32_t i = 0; i < num; i++) {
+					if (codeLengths[i] > MAX_CODE_BITS) return false;
+					count[codeLengths[i]]++;
+				}
+				count[0] = 0;
+				// Over-subscribed codes are invalid, incomplete ones are allowed
+				int32_t left = 1;
+				maxBits = 0;
+				for (uint32_t bits = 1; bits <= MAX_CODE_BITS; bits++) {
+					left = (left << 1) - count[bits];
+					if (left < 0) return false;
+					if (count[bits]) maxBits = bits;
+				}
+				std::array<uint16_t, MAX_CODE_BITS + 1> nextCode{};
+				uint16_t code = 0;
+				for (uint32_t bits = 1; bits <= MAX_CODE_BITS; bits++) {
+					code = (code + count[bits - 1]) << 1;
+					nextCode[bits] = code;
+				}
+				lengths.fill(0);
+				for (uint32_t symbol = 0; symbol < num; symbol++) {
+					const uint8_t length = codeLengths[symbol];
+					lengths[symbol] = length;
+					if (length) {
+						codes[symbol] = reverseBits(nextCode[length]++, length);
+					}
+				}
+				if (forDecode) {
+					table.assign(1ULL << maxBits, 0);
+					for (uint32_t symbol = 0; symbol < num; symbol++) {
+						const uint8_t length = lengths[symbol];
+						if (!length) continue;
+						for (uint64_t i = codes[symbol]; i < table.size(); i += 1ULL << length) {
+							table[i] = symbol << 4 | length;
+						}
+					}
+				}
+				return true;
+			}
+
+			bool decode(DeflateReader &reader, uint16_t &symbol) const {
+				const uint16_t entry = table[reader.peek(maxBits)];
+				if (!entry) return false;
+				reader.drop(entry & 0xF);
+				symbol = entry >> 4;
+				return true;
+			}
+
+			bool encode(DeflateWriter &writer, uint16_t symbol) const {
+				if (!lengths[symbol]) return false;
+				writer.write(lengths[symbol], codes[symbol]);
+				return true;
+			}
+	};
+
+	static const HuffmanCode &getFixedLitLenCode() {
+		static const HuffmanCode code = [] {
+			std::array<uint8_t, FIXED_LIT_LEN_CODES> lengths{};
+			std::fill(lengths.begin(), lengths.begin() + 144, 8);
+			std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+			std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+			std::fill(lengths.begin() + 280, lengths.end(), 8);
+			HuffmanCode fixedCode;
+			fixedCode.build(lengths.data(), lengths.size(), true);
+			return fixedCode;
+		}();
+		return code;
+	}
+
+	static const HuffmanCode &getFixedDistanceCode() {
+		static const HuffmanCode code = [] {
+			std::array<uint8_t, MAX_DISTANCE_CODES> lengths{};
+			lengths.fill(5);
+			HuffmanCode fixedCode;
+			fixedCode.build(lengths.data(), lengths.size(), true);
+			return fixedCode;
+		}();
+		return code;
+	}
+
+	class PuffWriter {
+		uint8_t *out;
+		uint64_t size;
+		uint64_t pos = 0;
+		// Literals follow a one byte length, moved by two bytes once they need the long one
+		uint64_t literalsPos = 0;
+		uint32_t literalsLength = 0;
+
+		bool flushLiterals() {
+			if (literalsLength == 0) return true;
+			if (literalsLength <= 127) {
+				out[literalsPos] = literalsLength - 1;
+			} else {
+				out[literalsPos] = 127;
+				writeBE16(out + literalsPos + 1, literalsLength - 128);
+			}
+			literalsLength = 0;
+			return true;
+		}
+
+		public:
+			PuffWriter(uint8_t *out, uint64_t size) : out(out), size(size) {
+			}
+
+			bool literal(uint8_t byte) {
+				if (literalsLength == 0) {
+					literalsPos = pos++;
+				} else if (literalsLength == 127) {
+					if (pos + 2 > size) return false;
+					memmove(out + literalsPos + 3, out + literalsPos + 1, 127);
+					pos += 2;
+				}
+				if (pos >= size) return false;
+				out[pos++] = byte;
+				if (++literalsLength == MAX_LITERALS_LENGTH) {
+					return flushLiterals();
+				}
+				return true;
+			}
+
+			bool lengthDistance(uint32_t length, uint32_t distance) {
+				if (!flushLiterals() || pos + (length < 130 ? 3 : 4) > size) return false;
+				if (length < 130) {
+					out[pos++] = 0x80 | (length - 3);
+				} else {
+					out[pos++] = 0xFF;
+					out[pos++] = length - 130;
+				}
+				writeBE16(out + pos, distance - 1);
+				pos += 2;
+				return true;
+			}
+
+			bool endOfBlock() {
+				if (!flushLiterals() || pos + 2 > size) return false;
+				out[pos++] = 0xFF;
+				out[pos++] = 259 - 130;
+				return true;
+			}
+
+			bool metadata(const uint8_t *data, uint32_t length) {
+				if (!flushLiterals() || pos + 2 + length > size) return false;
+				writeBE16(out + pos, length - 1);
+				memcpy(out + pos + 2, data, length);
+				pos += 2 + length;
+				return true;
+			}
+
+			bool finish() {
+				return flushLiterals() && pos == size;
+			}
+	};
+
+	class PuffReader {
+		const uint8_t *data;
+		uint64_t size;
+		uint64_t pos = 0;
+
+		public:
+			enum ItemType : uint8_t {
+				ITEM_LITERALS,
+				ITEM_LENGTH_DISTANCE,
+				ITEM_END_OF_BLOCK,
+			};
+
+			class Item {
+				public:
+					ItemType type = ITEM_END_OF_BLOCK;
+					const uint8_t *literals = nullptr;
+					uint32_t length = 0;
+					uint32_t distance = 0;
+			};
+
+			PuffReader(const uint8_t *data, uint64_t size) : data(data), size(size) {
+			}
+
+			bool hasData() const { return pos < size; }
+
+			bool readMetadata(const uint8_t *&metadata, uint32_t &length) {
+				if (pos + 2 > size) return false;
+				length = readBE16(data + pos) + 1;
+				pos += 2;
+				if (length > MAX_METADATA_SIZE || pos + length > size) return false;
+				metadata = data + pos;
+				pos += length;
+				return true;
+			}
+
+			bool readItem(Item &item) {
+				if (pos >= size) return false;
+				const uint8_t header = data[pos++];
+				if (header & 0x80) {
+					uint32_t length = header & 0x7F;
+					if (length == 127) {
+						if (pos >= size) return false;
+						length += data[pos++];
+					}
+					length += 3;
+					if (length == 259) {
+						item.type = ITEM_END_OF_BLOCK;
+						return true;
+					}
+					if (length > 258 || pos + 2 > size) return false;
+					item.type = ITEM_LENGTH_DISTANCE;
+					item.length = length;
+					item.distance = readBE16(data + pos) + 1;
+					pos += 2;
+					return item.distance <= 32768;
+				}
+				uint32_t length = header;
+				if (length == 127) {
+					if (pos + 2 > size) return false;
+					length += readBE16(data + pos);
+					pos += 2;
+				}
+				length++;
+				if (pos + length > size) return false;
+				item.type = ITEM_LITERALS;
+				item.literals = data + pos;
+				item.length = length;
+				pos += length;
+				return true;
+			}
+	};
+
+	/**
+	 * The dynamic block header is kept in the metadata as read: the counts, the code length
+	 * code lengths as nibbles, then a byte per code length or repeat code with its extra bits:
+	 * 0-15 lengths, 16-19 repeat previous, 20-27 and 28-155 repeat zero.
+	 */
+	static bool puffDynamicHeader(DeflateReader &reader, uint8_t *metadata, uint32_t &metadataSize,
+	                              HuffmanCode &litLenCode, HuffmanCode &distanceCode) {
+		uint32_t index = 1;
+		metadata[index++] = reader.read(5);
+		const uint32_t litLenNum = metadata[1] + 257;
+		metadata[index++] = reader.read(5);
+		const uint32_t distanceNum = metadata[2] + 1;
+		metadata[index++] = reader.read(4);
+		const uint32_t codeNum = metadata[3] + 4;
+		if (litLenNum > MAX_LIT_LEN_CODES || distanceNum > MAX_DISTANCE_CODES) return false;
+
+		std::array<uint8_t, 19> codeLengthLengths{};
+		for (uint32_t i = 0; i < codeNum; i++) {
+			const uint8_t length = reader.read(3);
+			codeLengthLengths[CODE_LENGTH_ORDER[i]] = length;
+			if (i % 2 == 0) {
+				metadata[index] = length << 4;
+			} else {
+				metadata[index++] |= length;
+			}
+		}
+		if (codeNum % 2) index++;
+		HuffmanCode codeLengthCode;
+		if (!codeLengthCode.build(codeLengthLengths.data(), codeLengthLengths.size(), true)) return false;
+
+		// Repeats may cross from the literal/length to the distance code lengths
+		std::array<uint8_t, MAX_LIT_LEN_CODES + MAX_DISTANCE_CODES> lengths{};
+		const uint32_t lengthNum = litLenNum + distanceNum;
+		for (uint32_t n = 0; n < lengthNum;) {
+			uint16_t symbol;
+			if (!codeLengthCode.decode(reader, symbol)) return false;
+			if (symbol < 16) {
+				metadata[index++] = symbol;
+				lengths[n++] = symbol;
+				continue;
+			}
+			uint32_t repeat;
+			uint8_t length = 0;
+			if (symbol == 16) {
+				if (n == 0) return false;
+				const uint32_t extra = reader.read(2);
+				metadata[index++] = 16 + extra;
+				repeat = 3 + extra;
+				length = lengths[n - 1];
+			} else if (symbol == 17) {
+				const uint32_t extra = reader.read(3);
+				metadata[index++] = 20 + extra;
+				repeat = 3 + extra;
+			} else {
+				const uint32_t extra = reader.read(7);
+				metadata[index++] = 28 + extra;
+				repeat = 11 + extra;
+			}
+			if (n + repeat > lengthNum) return false;
+			std::fill_n(lengths.begin() + n, repeat, length);
+			n += repeat;
+		}
+		metadataSize = index;
+		return litLenCode.build(lengths.data(), litLenNum, true) &&
+		       distanceCode.build(lengths.data() + litLenNum, distanceNum, true);
+	}
+
+	static bool huffDynamicHeader(DeflateWriter &writer, const uint8_t *metadata, uint32_t metadataSize,
+	                              HuffmanCode &litLenCode, HuffmanCode &distanceCode) {
+		if (metadataSize < 4 || metadata[1] >= 32 || metadata[2] >= 32 || metadata[3] >= 16) return false;
+		const uint32_t litLenNum = metadata[1] + 257;
+		const uint32_t distanceNum = metadata[2] + 1;
+		const uint32_t codeNum = metadata[3] + 4;
+		if (litLenNum > MAX_LIT_LEN_CODES || distanceNum > MAX_DISTANCE_CODES) return false;
+		writer.write(5, metadata[1]);
+		writer.write(5, metadata[2]);
+		writer.write(4, metadata[3]);
+
+		uint32_t index = 4;
+		if (index + (codeNum + 1) / 2 > metadataSize) return false;
+		std::array<uint8_t, 19> codeLengthLengths{};
+		for (uint32_t i = 0; i < codeNum; i++) {
+			const uint8_t nibbles = metadata[index + i / 2];
+			const uint8_t length = i % 2 ? nibbles & 0xF : nibbles >> 4;
+			if (length > 7) return false;
+			codeLengthLengths[CODE_LENGTH_ORDER[i]] = length;
+			writer.write(3, length);
+		}
+		index += (codeNum + 1) / 2;
+		HuffmanCode codeLengthCode;
+		if (!codeLengthCode.build(codeLengthLengths.data(), codeLengthLengths.size(), false)) return false;
+
+		std::array<uint8_t, MAX_LIT_LEN_CODES + MAX_DISTANCE_CODES> lengths{};
+		const uint32_t lengthNum = litLenNum + distanceNum;
+		for (uint32_t n = 0; n < lengthNum;) {
+			if (index >= metadataSize) return false;
+			const uint8_t value = metadata[index++];
+			if (value < 16) {
+				if (!codeLengthCode.encode(writer, value)) return false;
+				lengths[n++] = value;
+				continue;
+			}
+			uint16_t symbol;
+			uint32_t extraBits, extra, repeat;
+			uint8_t length = 0;
+			if (value < 20) {
+				if (n == 0) return false;
+				symbol = 16;
+				extraBits = 2;
+				extra = value - 16;
+				repeat = 3 + extra;
+				length = lengths[n - 1];
+			} else if (value < 28) {
+				symbol = 17;
+				extraBits = 3;
+				extra = value - 20;
+				repeat = 3 + extra;
+			} else if (value < 156) {
+				symbol = 18;
+				extraBits = 7;
+				extra = value - 28;
+				repeat = 11 + extra;
+			} else {
+				return false;
+			}
+			if (n + repeat > lengthNum || !codeLengthCode.encode(writer, symbol)) return false;
+			writer.write(extraBits, extra);
+			std::fill_n(lengths.begin() + n, repeat, length);
+			n += repeat;
+		}
+		return index == metadataSize &&
+		       litLenCode.build(lengths.data(), litLenNum, false) &&
+		       distanceCode.build(lengths.data() + litLenNum, distanceNum, false);
+	}
+
+	bool Puff::puffDeflate(const uint8_t *in, uint64_t inSize, uint64_t bitOffset, uint64_t bitLength,
+	                       uint8_t *out, uint64_t outSize) {
+		const uint64_t byteEnd = (bitOffset + bitLength + 7) / 8;
+		if (byteEnd > inSize) return false;
+		// As puffin, blocks are read while a byte is left up to the end of the last byte
+		DeflateReader reader{in, bitOffset, byteEnd * 8};
+		PuffWriter writer{out, outSize};
+		HuffmanCode litLenCode, distanceCode;
+		uint8_t metadata[MAX_METADATA_SIZE];
+
+		while (reader.remaining() >= 8) {
+			const uint32_t isFinal = reader.read(1);
+			const uint32_t type = reader.read(2);
+			// Block header: final bit, type, the skipped bits of stored blocks
+			metadata[0] = isFinal << 7 | type << 5;
+			const HuffmanCode *litLen, *distance;
+			switch (type) {
+				case BLOCK_UNCOMPRESSED: {
+					metadata[0] |= reader.read((8 - reader.position() % 8) % 8);
+					const uint32_t length = reader.read(16);
+					if ((length ^ reader.read(16)) != 0xFFFF) return false;
+					const uint8_t *data = reader.readBytes(length);
+					if (!data || !writer.metadata(metadata, 1)) return false;
+					for (uint32_t i = 0; i < length; i++) {
+						if (!writer.literal(data[i])) return false;
+					}
+					if (!writer.endOfBlock()) return false;
+					continue;
+				}
+				case BLOCK_FIXED:
+					if (!writer.metadata(metadata, 1)) return false;
+					litLen = &getFixedLitLenCode();
+					distance = &getFixedDistanceCode();
+					break;
+				case BLOCK_DYNAMIC: {
+					uint32_t metadataSize;
+					if (!puffDynamicHeader(reader, metadata, metadataSize, litLenCode, distanceCode) ||
+					    !writer.metadata(metadata, metadataSize)) {
+						return false;
+					}
+					litLen = &litLenCode;
+					distance = &distanceCode;
+					break;
+				}
+				default:
+					return false;
+			}
+
+			while (true) {
+				uint16_t symbol;
+				if (!litLen->decode(reader, symbol)) return false;
+				if (symbol < END_OF_BLOCK) {
+					if (!writer.literal(symbol)) return false;
+					continue;
+				}
+				if (symbol == END_OF_BLOCK) {
+					if (!writer.endOfBlock()) return false;
+					break;
+				}
+				symbol -= END_OF_BLOCK + 1;
+				if (symbol >= std::size(LENGTH_BASES)) return false;
+				const uint32_t length = LENGTH_BASES[symbol] + reader.read(LENGTH_EXTRA_BITS[symbol]);
+				if (!distance->decode(reader, symbol) || symbol >= std::size(DISTANCE_BASES)) return false;
+				const uint32_t dist = DISTANCE_BASES[symbol] + reader.read(DISTANCE_EXTRA_BITS[symbol]);
+				if (!writer.lengthDistance(length, dist)) return false;
+			}
+			if (reader.isOverrun()) return false;
+		}
+		return (reader.position() + 7) / 8 == byteEnd && writer.finish();
+	}
+
+	bool Puff::huffDeflate(const uint8_t *puff, uint64_t puffSize, uint8_t *out, uint64_t outSize,
+	                       uint64_t bitOffset, uint64_t bitLength) {
+		PuffReader reader{puff, puffSize};
+		DeflateWriter writer{out, outSize, bitOffset};
+		HuffmanCode litLenCode, distanceCode;
+		PuffReader::Item item;
+
+		while (reader.hasData()) {
+			const uint8_t *metadata;
+			uint32_t metadataSize;
+			if (!reader.readMetadata(metadata, metadataSize)) return false;
+			const uint32_t type = metadata[0] >> 5 & 0x3;
+			writer.write(1, metadata[0] >> 7);
+			writer.write(2, type);
+			const HuffmanCode *litLen, *distance;
+			switch (type) {
+				case BLOCK_UNCOMPRESSED: {
+					const uint32_t skippedBits = (8 - writer.position() % 8) % 8;
+					if (metadataSize != 1 || !reader.readItem(item)) return false;
+					writer.write(skippedBits, metadata[0] & ((1U << skippedBits) - 1));
+					// An empty stored block has no literals
+					if (item.type == PuffReader::ITEM_END_OF_BLOCK) {
+						writer.write(16, 0);
+						writer.write(16, 0xFFFF);
+						continue;
+					}
+					if (item.type != PuffReader::ITEM_LITERALS || item.length > 0xFFFF) return false;
+					writer.write(16, item.length);
+					writer.write(16, ~item.length & 0xFFFF);
+					writer.writeBytes(item.literals, item.length);
+					if (!reader.readItem(item) || item.type != PuffReader::ITEM_END_OF_BLOCK) return false;
+					continue;
+				}
+				case BLOCK_FIXED:
+					if (metadataSize != 1) return false;
+					litLen = &getFixedLitLenCode();
+					distance = &getFixedDistanceCode();
+					break;
+				case BLOCK_DYNAMIC:
+					if (!huffDynamicHeader(writer, metadata, metadataSize, litLenCode, distanceCode)) return false;
+					litLen = &litLenCode;
+					distance = &distanceCode;
+					break;
+				default:
+					return false;
+			}
+
+			while (true) {
+				if (!reader.readItem(item)) return false;
+				if (item.type == PuffReader::ITEM_LITERALS) {
+					for (uint32_t i = 0; i < item.length; i++) {
+						if (!litLen->encode(writer, item.literals[i])) return false;
+					}
+				} else if (item.type == PuffReader::ITEM_LENGTH_DISTANCE) {
+					// 258 always takes its own code, as zlib writes it
+					const uint16_t lengthCode = std::ranges::upper_bound(LENGTH_BASES, item.length) - LENGTH_BASES - 1;
+					if (!litLen->encode(writer, END_OF_BLOCK + 1 + lengthCode)) return false;
+					writer.write(LENGTH_EXTRA_BITS[lengthCode], item.length - LENGTH_BASES[lengthCode]);
+					const uint16_t distanceCode = std::ranges::upper_bound(DISTANCE_BASES, item.distance) -
+					                              DISTANCE_BASES - 1;
+					if (!distance->encode(writer, distanceCode)) return false;
+					writer.write(DISTANCE_EXTRA_BITS[distanceCode], item.distance - DISTANCE_BASES[distanceCode]);
+				} else {
+					if (!litLen->encode(writer, END_OF_BLOCK)) return false;
+					break;
+				}
+			}
+		}
+		return writer.finish() && writer.position() == bitOffset + bitLength;
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef PAYLOAD_EXTRACT_PUFF_H
+#define PAYLOAD_EXTRACT_PUFF_H
+
+#include <cinttypes>
+
+namespace skkk {
+	/**
+	 * The puff format of puffin: deflate blocks without their Huffman coding, so bsdiff
+	 * sees the literals and length/distance pairs. Huffing rebuilds the exact deflate bits.
+	 *     block metadata:  [length - 1: u16 BE] [F|TP|SKIP] [dynamic Huffman header]
+	 *     literals:        [0|length - 1] or [0x7F] [length - 128: u16 BE], then the bytes
+	 *     length/distance: [1|length - 3] or [0xFF] [length - 130], then [distance - 1: u16 BE]
+	 *     end of block:    [0xFF] [0x81]
+	 */
+	class Puff {
+		public:
+			/**
+			 * Puffs the deflate blocks at bits [bitOffset, bitOffset + bitLength) of in,
+			 * the puff has to fill out exactly.
+			 */
+			static bool puffDeflate(const uint8_t *in, uint64_t inSize, uint64_t bitOffset, uint64_t bitLength,
+			                        uint8_t *out, uint64_t outSize);
+
+			/**
+			 * Writes the deflate bits of puff to out from bitOffset, the bits below bitOffset in
+			 * the first byte are kept. The deflate has to end at bitOffset + bitLength.
+			 */
+			static bool huffDeflate(const uint8_t *puff, uint64_t puffSize, uint8_t *out, uint64_t outSize,
+			                        uint64_t bitOffset, uint64_t bitLength);
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_PUFF_H
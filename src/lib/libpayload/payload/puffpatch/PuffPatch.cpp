@@ -0,0 +1,262 @@
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <bsdiff/bspatch.h>
+
+#include "Puff.h"
+#include "PuffPatch.h"
+#include "common/ProtoReader.h"
+#include "payload/common/Buffer.hpp"
+#include "zucchini/ZucchiniPatch.h"
+
+namespace skkk {
+	static constexpr char PUFFDIFF_MAGIC[] = "PUF1";
+	static constexpr uint32_t PUFFDIFF_MAGIC_SIZE = 4;
+	// Puffed data can't be much larger than its deflate bits, a bound for broken headers
+	static constexpr uint64_t MAX_PUFF_BYTES_PER_BIT = 8;
+	static constexpr uint64_t MAX_PUFF_EXTRA_SIZE = 1024;
+
+	enum PuffPatchType : uint64_t {
+		PATCH_BSDIFF = 0,
+		PATCH_ZUCCHINI = 1,
+	};
+
+	class BitExtent {
+		public:
+			uint64_t offset = 0;
+			uint64_t length = 0;
+	};
+
+	/**
+	 * StreamInfo of the PatchHeader, deflates in bits and puffs in bytes
+	 */
+	class PuffStreamInfo {
+		public:
+			std::vector<BitExtent> deflates;
+			std::vector<BitExtent> puffs;
+			uint64_t puffSize = 0;
+	};
+
+	class PuffPatchHeader {
+		public:
+			PuffStreamInfo src;
+			PuffStreamInfo dst;
+			uint64_t type = PATCH_BSDIFF;
+	};
+
+	// message BitExtent { uint64 offset = 1; uint64 length = 2; }
+	static bool parseBitExtent(ProtoReader reader, BitExtent &extent) {
+		while (reader.hasData()) {
+			uint32_t field, wireType;
+			if (!reader.readField(field, wireType)) return false;
+			bool isOk;
+			if (field == 1 && wireType == 0) {
+				isOk = reader.readVarint(extent.offset);
+			} else if (field == 2 && wireType == 0) {
+				isOk = reader.readVarint(extent.length);
+			} else {
+				isOk = reader.skip(wireType);
+			}
+			if (!isOk) return false;
+		}
+		return true;
+	}
+
+	// message StreamInfo { repeated BitExtent deflates = 1; repeated BitExtent puffs = 2; uint64 puff_length = 3; }
+	static bool parseStreamInfo(ProtoReader reader, PuffStreamInfo &info) {
+		while (reader.hasData()) {
+			uint32_t field, wireType;
+			if (!reader.readField(field, wireType)) return false;
+			ProtoReader message{nullptr, 0};
+			BitExtent extent;
+			bool isOk;
+			if ((field == 1 || field == 2) && wireType == 2) {
+				isOk = reader.readMessage(message) && parseBitExtent(message, extent);
+				if (field == 1) {
+					info.deflates.emplace_back(extent);
+				} else {
+					// Puffs are byte extents stored in bits
+					isOk = isOk && extent.offset % 8 == 0 && extent.length % 8 == 0;
+					info.puffs.emplace_back(extent.offset / 8, extent.length / 8);
+				}
+			} else if (field == 3 && wireType == 0) {
+				isOk = reader.readVarint(info.puffSize);
+			} else {
+				isOk = reader.skip(wireType);
+			}
+			if (!isOk) return false;
+		}
+		return info.deflates.size() == info.puffs.size();
+	}
+
+	// message PatchHeader { int32 version = 1; StreamInfo src = 2; StreamInfo dst = 3; PatchType type = 4; }
+	static bool parsePatchHeader(ProtoReader reader, PuffPatchHeader &header) {
+		while (reader.hasData()) {
+			uint32_t field, wireType;
+			if (!reader.readField(field, wireType)) return false;
+			ProtoReader message{nullptr, 0};
+			bool isOk;
+			if ((field == 2 || field == 3) && wireType == 2) {
+				isOk = reader.readMessage(message) &&
+				       parseStreamInfo(message, field == 2 ? header.src : header.dst);
+			} else if (field == 4 && wireType == 0) {
+				isOk = reader.readVarint(header.type);
+			} else {
+				isOk = reader.skip(wireType);
+			}
+			if (!isOk) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Bytes between two deflates (or the stream ends), copied as they are to the puffed stream.
+	 * A byte shared with a deflate keeps only its other bits there: behind a deflate shifted down,
+	 * in front of one masked. Deflates ending and starting in the same byte share no raw byte.
+	 */
+	class RawRegion {
+		public:
+			uint64_t start = 0;
+			uint64_t end = 0;
+			// Bits of the previous deflate in the first byte
+			uint32_t headBits = 0;
+			// Bits in front of the next deflate in the last byte
+			uint32_t tailBits = 0;
+
+		public:
+			RawRegion(const BitExtent *prev, const BitExtent *next, uint64_t streamSize) {
+				if (prev) {
+					start = (prev->offset + prev->length) / 8;
+					headBits = (prev->offset + prev->length) % 8;
+				}
+				if (next) {
+					end = (next->offset + 7) / 8;
+					tailBits = next->offset % 8;
+					if (tailBits && prev && prev->offset + prev->length == next->offset) {
+						end--;
+					}
+				} else {
+					end = streamSize;
+				}
+			}
+
+			uint64_t size() const { return end - start; }
+	};
+
+	static bool checkDeflate(const BitExtent *prev, const BitExtent *deflate, const BitExtent &puff,
+	                         uint64_t streamSize) {
+		const uint64_t prevEnd = prev ? prev->offset + prev->length : 0;
+		return deflate->offset >= prevEnd && deflate->length <= streamSize * 8 &&
+		       deflate->offset <= streamSize * 8 - deflate->length &&
+		       puff.length <= deflate->length * MAX_PUFF_BYTES_PER_BIT + MAX_PUFF_EXTRA_SIZE;
+	}
+
+	static bool puffStream(const uint8_t *in, uint64_t inSize, const PuffStreamInfo &info, uint8_t *out) {
+		const uint64_t deflateNum = info.deflates.size();
+		uint64_t puffPos = 0;
+		const BitExtent *prev = nullptr;
+		for (uint64_t i = 0; i <= deflateNum; i++) {
+			const BitExtent *deflate = i < deflateNum ? &info.deflates[i] : nullptr;
+			if (deflate && !checkDeflate(prev, deflate, info.puffs[i], inSize)) return false;
+			const RawRegion raw{prev, deflate, inSize};
+			const uint64_t puffOffset = deflate ? info.puffs[i].offset : info.puffSize;
+			if (puffOffset > info.puffSize || puffPos + raw.size() != puffOffset) return false;
+			if (raw.size()) {
+				memcpy(out + puffPos, in + raw.start, raw.size());
+				if (raw.headBits) {
+					out[puffPos] >>= raw.headBits;
+				}
+				if (raw.tailBits) {
+					const uint32_t bits = raw.tailBits - (raw.size() == 1 ? raw.headBits : 0);
+					out[puffOffset - 1] &= (1U << bits) - 1;
+				}
+			}
+			puffPos = puffOffset;
+			if (!deflate) break;
+
+			const BitExtent &puff = info.puffs[i];
+			if (puff.length > info.puffSize - puffPos ||
+			    !Puff::puffDeflate(in, inSize, deflate->offset, deflate->length, out + puffPos, puff.length)) {
+				return false;
+			}
+			puffPos += puff.length;
+			prev = deflate;
+		}
+		return true;
+	}
+
+	static bool huffStream(const uint8_t *puffData, const PuffStreamInfo &info, uint8_t *out, uint64_t outSize) {
+		const uint64_t deflateNum = info.deflates.size();
+		uint64_t puffPos = 0;
+		const BitExtent *prev = nullptr;
+		for (uint64_t i = 0; i <= deflateNum; i++) {
+			const BitExtent *deflate = i < deflateNum ? &info.deflates[i] : nullptr;
+			if (deflate && !checkDeflate(prev, deflate, info.puffs[i], outSize)) return false;
+			const RawRegion raw{prev, deflate, outSize};
+			const uint64_t puffOffset = deflate ? info.puffs[i].offset : info.puffSize;
+			if (puffOffset > info.puffSize || puffPos + raw.size() != puffOffset) return false;
+			if (raw.size()) {
+				const uint8_t *rawData = puffData + puffPos;
+				uint8_t *dest = out + raw.start;
+				// The low bits are the end of the previous deflate
+				const uint8_t headByte = raw.headBits ? (dest[0] & ((1U << raw.headBits) - 1)) | rawData[0] << raw.headBits
+					                         : rawData[0];
+				memcpy(dest, rawData, raw.size());
+				dest[0] = headByte;
+			}
+			puffPos = puffOffset;
+			if (!deflate) break;
+
+			const BitExtent &puff = info.puffs[i];
+			if (puff.length > info.puffSize - puffPos ||
+			    !Puff::huffDeflate(puffData + puffPos, puff.length, out, outSize, deflate->offset, deflate->length)) {
+				return false;
+			}
+			puffPos += puff.length;
+			prev = deflate;
+		}
+		return true;
+	}
+
+	int PuffPatch::apply(const uint8_t *src, uint64_t srcSize, const uint8_t *patch, uint64_t patchSize,
+	                     uint8_t *dest, uint64_t destSize) {
+		if (patchSize < PUFFDIFF_MAGIC_SIZE + 4 || memcmp(patch, PUFFDIFF_MAGIC, PUFFDIFF_MAGIC_SIZE) != 0) {
+			return -EBADMSG;
+		}
+		const uint8_t *sizeData = patch + PUFFDIFF_MAGIC_SIZE;
+		const uint32_t headerSize = sizeData[0] << 24 | sizeData[1] << 16 | sizeData[2] << 8 | sizeData[3];
+		const uint64_t bsdiffOffset = PUFFDIFF_MAGIC_SIZE + 4ULL + headerSize;
+		if (bsdiffOffset > patchSize) return -EBADMSG;
+
+		PuffPatchHeader header;
+		if (!parsePatchHeader(ProtoReader{patch + PUFFDIFF_MAGIC_SIZE + 4, headerSize}, header)) return -EBADMSG;
+		if (header.type != PATCH_BSDIFF && header.type != PATCH_ZUCCHINI) return -ENOTSUP;
+
+		Buffer<uint8_t> srcPuff{header.src.puffSize};
+		if (!puffStream(src, srcSize, header.src, srcPuff.get())) return -EBADMSG;
+
+		Buffer<uint8_t> dstPuff{header.dst.puffSize};
+		if (header.type == PATCH_ZUCCHINI) {
+			const int ret = ZucchiniPatch::apply(srcPuff.get(), header.src.puffSize, patch + bsdiffOffset,
+			                                     patchSize - bsdiffOffset, dstPuff.get(), header.dst.puffSize);
+			if (ret) return ret;
+			srcPuff = Buffer<uint8_t>{};
+			return huffStream(dstPuff.get(), header.dst, dest, destSize) ? 0 : -EBADMSG;
+		}
+		uint64_t patchedSize = 0;
+		auto sink = [&dstPuff, &patchedSize, &header](const uint8_t *data, size_t len) -> size_t {
+			if (patchedSize + len > header.dst.puffSize) return 0;
+			memcpy(dstPuff.get() + patchedSize, data, len);
+			patchedSize += len;
+			return len;
+		};
+		if (bsdiff::bspatch(srcPuff.get(), header.src.puffSize, patch + bsdiffOffset, patchSize - bsdiffOffset, sink) ||
+		    patchedSize != header.dst.puffSize) {
+			return -EBADMSG;
+		}
+		srcPuff = Buffer<uint8_t>{};
+
+		return huffStream(dstPuff.get(), header.dst, dest, destSize) ? 0 : -EBADMSG;
+	}
+}
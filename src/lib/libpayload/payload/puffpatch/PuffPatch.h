@@ -0,0 +1,23 @@
+#ifndef PAYLOAD_EXTRACT_PUFFPATCH_H
+#define PAYLOAD_EXTRACT_PUFFPATCH_H
+
+#include <cinttypes>
+
+namespace skkk {
+	/**
+	 * Applies a puffdiff patch: "PUF1", the header size (u32 BE), the puffin PatchHeader protobuf
+	 * with the deflate streams of both sides, then the bsdiff (or zucchini) patch of the puffed data.
+	 * The deflates of src are puffed, the bsdiff patch gives the puffed dest,
+	 * its deflates are huffed back into dest.
+	 */
+	class PuffPatch {
+		public:
+			/**
+			 * -EBADMSG for a broken patch or deflate stream, -ENOTSUP for zucchini patches of executables.
+			 */
+			static int apply(const uint8_t *src, uint64_t srcSize, const uint8_t *patch, uint64_t patchSize,
+			                 uint8_t *dest, uint64_t destSize);
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_PUFFPATCH_H
@@ -1,9 +1,9 @@
 #include <cinttypes>
+#include <latch>
 #include <print>
 #include <ranges>
 
 #include "common/LogProgress.h"
-#include "common/threadpool.h"
 #include "payload/ExtractConfig.h"
 #include "payload/LogBase.h"
 #include "payload/Utils.h"
@@ -25,9 +25,11 @@ namespace skkk {
 	};
 
 	VerifyWriter::VerifyWriter(const std::vector<PartitionInfo> &partitions,
-	                           const ExtractConfig &config)
+	                           const ExtractConfig &config,
+	                           const std::shared_ptr<std::threadpool> &threadPool)
 		: partitions(partitions),
-		  config(config) {
+		  config(config),
+		  threadPool(threadPool) {
 	}
 
 #define PRINT_PROGRESS_HASH_FMT \
@@ -85,15 +87,12 @@ namespace skkk {
 		}
 	}
 
-	static void sha256HashTreeTopLevelTask(const VerifyWriterHashTreeContext &ctx) {
+	static void sha256HashTreeTopLevelTask(const VerifyInfo &info, const uint8_t *inData, uint8_t *hashData,
+	                                       uint64_t beginBlock, uint64_t endBlock) {
 		int ret = -1;
-		const auto &info = ctx.verifyInfo;
 		const auto &excSize = info.hashTreeExcSize;
 		const auto &calcProgress = info.hashTreeProgress;
 		const auto hashTreeSalt = info.hashTreeSalt.data();
-		const auto readFilePos = ctx.readFilePos;
-		const auto writeHashPos = ctx.writeHashPos;
-		auto *hashData = ctx.hashData;
 		const auto blockSize = info.blockSize;
 		const auto hashTreeSaltSize = info.hashTreeSalt.size();
 		const auto SALT_VERIFY_SIZE = blockSize + hashTreeSaltSize;
@@ -102,15 +101,14 @@ namespace skkk {
 		auto *readData = sha256Data + hashTreeSaltSize;
 
 		memcpy(sha256Data, hashTreeSalt, hashTreeSaltSize);
-		ret = memcpy(readData, ctx.inData + readFilePos, blockSize) == readData ? 0 : -EIO;
-		if (ret) goto exit;
-		if (!sha256(sha256Data, SALT_VERIFY_SIZE, hashData + writeHashPos)) {
-			ret = -EIO;
+		for (uint64_t i = beginBlock; i < endBlock; i++) {
+			ret = memcpy(readData, inData + i * blockSize, blockSize) == readData ? 0 : -EIO;
+			if (!ret && !sha256(sha256Data, SALT_VERIFY_SIZE, hashData + i * SHA256_DIGEST_SIZE)) {
+				ret = -EIO;
+			}
+			if (ret) ++*excSize;
 		}
-
-	exit:
-		if (ret) ++*excSize;
-		++*calcProgress;
+		*calcProgress += static_cast<int>(endBlock - beginBlock);
 	}
 
 	bool VerifyWriter::handleHashTreeDataByInfo(const VerifyInfo &info) const {
@@ -144,16 +142,10 @@ namespace skkk {
 			progressThread = std::async(std::launch::async, printProgressMT, config.isSilent, info.name,
 			                            HASH_TREE_FMT, info.hashTreeTotalProgress, std::ref(*currentProgress),
 			                            true);
-			std::vector<VerifyWriterHashTreeContext> ctxs;
-			ctxs.reserve(topLevel.blockCount);
-			std::threadpool tp{config.threadNum};
-			while (readPos < info.hashTreeDataExtentSize) {
-				auto &ctx = ctxs.emplace_back(info, inData, readPos,
-				                              writeHashPos, preHashData);
-				tp.commit(sha256HashTreeTopLevelTask, std::ref(ctx));
-				readPos += blockSize;
-				writeHashPos += SHA256_DIGEST_SIZE;
-			}
+			const uint64_t blockCount = divRoundUp(info.hashTreeDataExtentSize, blockSize);
+			threadPool->parallelFor(0, blockCount, 0, [&info, inData, preHashData](uint64_t begin, uint64_t end) {
+				sha256HashTreeTopLevelTask(info, inData, preHashData, begin, end);
+			});
 		}
 
 		readPos = writeHashPos = 0;
@@ -208,23 +200,19 @@ namespace skkk {
 	/**
 	 * Reference: https://android.googlesource.com/platform/system/update_engine/+/refs/heads/main/payload_consumer/verity_writer_android.cc#328
 	 *
-	 * @param ctx
+	 * Encodes the rounds [beginRound, endRound), the rs codec and buffers are shared by the rounds.
 	 */
-	static void encodeFecTask(const VerifyWriterFecContext &ctx) {
+	static void encodeFecTask(const VerifyInfo &info, uint8_t *fecData, const uint8_t *inData,
+	                          uint64_t beginRound, uint64_t endRound) {
 		int ret = -1;
-		const auto &info = ctx.verifyInfo;
 		auto &currentProgress = info.fecProgress;
 		auto &fecExcSize = info.fecExcSize;
 		const auto fecRoots = info.fecRoots;
 		const auto fecRsn = info.fecRsn;
 		const auto dataSize = info.fecDataExtentSize;
 		const auto blockSize = info.blockSize;
-		const auto *inData = ctx.inData;
-		const auto roundsIdx = ctx.roundsIdx;
 		const auto rounds = info.fecRounds;
 		const auto dataOffset = info.fecDataExtentOffset;
-		const auto fecWriteOffset = roundsIdx * blockSize * fecRoots;
-		auto *fecData = ctx.fecData;
 		const uint32_t rsBlockSize = blockSize * fecRsn;
 
 		std::unique_ptr<void, decltype(&free_rs_char)> rs_char{init_rs_char(FEC_PARAMS(fecRoots)), &free_rs_char};
@@ -233,33 +221,35 @@ namespace skkk {
 		std::vector<uint8_t> bufferData(blockSize);
 		auto *buffer = bufferData.data();
 
-		for (size_t j = 0; j < fecRsn; j++) {
-			uint64_t offset =
-					fec_ecc_interleave(roundsIdx * fecRsn * blockSize + j, fecRsn, rounds);
-			if (offset < dataSize) {
-				ret = memcpy(buffer, inData + dataOffset + offset, blockSize) == buffer ? 0 : -EIO;
-				if (ret) {
-					++*fecExcSize;
-					goto exit;
+		for (uint64_t roundsIdx = beginRound; roundsIdx < endRound; roundsIdx++) {
+			const auto fecWriteOffset = roundsIdx * blockSize * fecRoots;
+			for (size_t j = 0; j < fecRsn; j++) {
+				uint64_t offset =
+						fec_ecc_interleave(roundsIdx * fecRsn * blockSize + j, fecRsn, rounds);
+				if (offset < dataSize) {
+					ret = memcpy(buffer, inData + dataOffset + offset, blockSize) == buffer ? 0 : -EIO;
+					if (ret) {
+						++*fecExcSize;
+						goto next;
+					}
 				}
+				for (size_t k = 0; k < blockSize; k++) {
+					rsBlocks[k * fecRsn + j] = buffer[k];
+				}
+				memset(buffer, 0, blockSize);
 			}
-			for (size_t k = 0; k < blockSize; k++) {
-				rsBlocks[k * fecRsn + j] = buffer[k];
+
+			for (size_t j = 0; j < blockSize; j++) {
+				encode_rs_char(rs_char.get(),
+				               rsBlocks + j * fecRsn,
+				               fecData + fecWriteOffset + j * fecRoots);
 			}
-			memset(buffer, 0, blockSize);
-		}
 
-		for (size_t j = 0; j < blockSize; j++) {
-			encode_rs_char(rs_char.get(),
-			               rsBlocks + j * fecRsn,
-			               fecData + fecWriteOffset + j * fecRoots);
+		next:
+			++*currentProgress;
 		}
-
-	exit:
-		++*currentProgress;
 	}
 
-
 	bool VerifyWriter::handleFecDataByInfo(const VerifyInfo &info) const {
 		int ret = 0, inFd = -1;
 		const auto fecDataSize = info.fecDataSize;
@@ -278,15 +268,15 @@ namespace skkk {
 		if (fecDataSize == fec_ecc_get_data_size(info.fecDataExtentSize, fecRoots)) {
 			//wait
 			{
-				std::vector<VerifyWriterFecContext> ctxs;
-				ctxs.reserve(fecRounds);
-				std::threadpool tp{config.threadNum};
-				for (int i = 0; i < fecRounds; i++) {
-					auto &ctx = ctxs.emplace_back(info, const_cast<uint8_t *>(info.fecData.data()), inData, i);
-					tp.commit(encodeFecTask, std::ref(ctx));
-				}
+				auto *fecData = const_cast<uint8_t *>(info.fecData.data());
+				std::latch done{static_cast<std::ptrdiff_t>(fecRounds)};
+				threadPool->commitRange(0, fecRounds, 0, [&info, fecData, inData, &done](uint64_t begin, uint64_t end) {
+					encodeFecTask(info, fecData, inData, begin, end);
+					done.count_down(static_cast<std::ptrdiff_t>(end - begin));
+				});
 				printProgressMT(config.isSilent, info.name, FEC_FMT,
 				                fecRounds, std::ref(*currentProgress), true);
+				done.wait();
 			}
 		}
 
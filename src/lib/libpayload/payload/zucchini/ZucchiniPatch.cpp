@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <brotli/decode.h>
+#include <lzma.h>
+
+#include "ZucchiniPatch.h"
+
+namespace skkk {
+	static constexpr uint32_t ZUCCHINI_MAGIC = 'Z' | 'u' << 8 | 'c' << 16 | 'c' << 24;
+	static constexpr uint16_t ZUCCHINI_MAJOR_VERSION = 1;
+	// Raw, single and ensemble patches, all serialized as an ensemble
+	static constexpr uint32_t ZUCCHINI_PATCH_TYPE_NUM = 3;
+	// Elements without references, the only ones applied without a disassembler
+	static constexpr uint32_t EXE_TYPE_NO_OP = 0;
+	static constexpr uint64_t BROTLI_MIN_OUTPUT_SIZE = 64 * 1024;
+
+	/**
+	 * Little endian reader over a region of the patch
+	 */
+	class PatchSource {
+		const uint8_t *data = nullptr;
+		const uint8_t *end = nullptr;
+
+		public:
+			PatchSource() = default;
+
+			PatchSource(const uint8_t *data, uint64_t size) : data(data), end(data + size) {
+			}
+
+			bool empty() const { return data == end; }
+
+			uint64_t size() const { return end - data; }
+
+			const uint8_t *get() const { return data; }
+
+			template<typename T>
+			bool getValue(T &value) {
+				if (size() < sizeof(T)) return false;
+				value = 0;
+				for (uint32_t i = 0; i < sizeof(T); i++) {
+					value |= static_cast<T>(static_cast<T>(data[i]) << i * 8);
+				}
+				data += sizeof(T);
+				return true;
+			}
+
+			bool getRegion(uint64_t regionSize, PatchSource &region) {
+				if (size() < regionSize) return false;
+				region = PatchSource{data, regionSize};
+				data += regionSize;
+				return true;
+			}
+
+			// A region prefixed by its u32 size
+			bool getBuffer(PatchSource &buffer) {
+				uint32_t bufferSize;
+				return getValue(bufferSize) && getRegion(bufferSize, buffer);
+			}
+
+			bool getVarUInt(uint32_t &value) {
+				value = 0;
+				for (uint32_t shift = 0; shift < 32 && data < end; shift += 7) {
+					const uint8_t byte = *data++;
+					value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+					if (!(byte & 0x80)) return true;
+				}
+				return false;
+			}
+
+			// Zigzag encoded
+			bool getVarInt(int32_t &value) {
+				uint32_t raw;
+				if (!getVarUInt(raw)) return false;
+				value = static_cast<int32_t>(raw & 1 ? ~(raw >> 1) : raw >> 1);
+				return true;
+			}
+	};
+
+	/**
+	 * Header layouts written by the Zucchini versions in use
+	 */
+	class PatchLayout {
+		public:
+			// Major/minor version behind the magic, version of the disassembler in element headers
+			bool hasVersion;
+			// Patch type in front of the element count
+			bool hasPatchType;
+	};
+
+	static constexpr PatchLayout PATCH_LAYOUTS[] = {
+		{true, false},
+		{true, true},
+		{false, true},
+		{false, false},
+	};
+
+	class Equivalence {
+		public:
+			uint64_t srcOffset = 0;
+			uint64_t dstOffset = 0;
+			uint64_t length = 0;
+	};
+
+	class ElementPatch {
+		public:
+			uint32_t oldOffset = 0;
+			uint32_t oldLength = 0;
+			uint32_t newOffset = 0;
+			uint32_t newLength = 0;
+			uint32_t exeType = EXE_TYPE_NO_OP;
+			PatchSource srcSkip;
+			PatchSource dstSkip;
+			PatchSource copyCount;
+			PatchSource extraData;
+			PatchSource rawDeltaSkip;
+			PatchSource rawDeltaDiff;
+			PatchSource referenceDelta;
+	};
+
+	class EnsemblePatch {
+		public:
+			uint32_t oldSize = 0;
+			uint32_t oldCrc = 0;
+			uint32_t newSize = 0;
+			uint32_t newCrc = 0;
+			std::vector<ElementPatch> elements;
+	};
+
+	static bool parseElement(PatchSource &source, const PatchLayout &layout, ElementPatch &element) {
+		uint16_t version;
+		uint32_t poolCount;
+		if (!source.getValue(element.oldOffset) || !source.getValue(element.oldLength) ||
+		    !source.getValue(element.newOffset) || !source.getValue(element.newLength) ||
+		    !source.getValue(element.exeType) || (layout.hasVersion && !source.getValue(version))) {
+			return false;
+		}
+		if (!source.getBuffer(element.srcSkip) || !source.getBuffer(element.dstSkip) ||
+		    !source.getBuffer(element.copyCount) || !source.getBuffer(element.extraData) ||
+		    !source.getBuffer(element.rawDeltaSkip) || !source.getBuffer(element.rawDeltaDiff) ||
+		    !source.getBuffer(element.referenceDelta) || !source.getValue(poolCount)) {
+			return false;
+		}
+		// Extra targets of the reference pools, only used by the reference correction
+		for (uint32_t i = 0; i < poolCount; i++) {
+			uint8_t poolTag;
+			PatchSource extraTargets;
+			if (!source.getValue(poolTag) || !source.getBuffer(extraTargets)) return false;
+		}
+		return true;
+	}
+
+	static bool parseEnsemble(const uint8_t *patch, uint64_t patchSize, const PatchLayout &layout,
+	                          EnsemblePatch &ensemble) {
+		PatchSource source{patch, patchSize};
+		uint32_t magic, patchType, elementNum;
+		uint16_t majorVersion, minorVersion;
+		if (!source.getValue(magic) || magic != ZUCCHINI_MAGIC) return false;
+		if (layout.hasVersion && (!source.getValue(majorVersion) || !source.getValue(minorVersion) ||
+		                          majorVersion != ZUCCHINI_MAJOR_VERSION)) {
+			return false;
+		}
+		if (!source.getValue(ensemble.oldSize) || !source.getValue(ensemble.oldCrc) ||
+		    !source.getValue(ensemble.newSize) || !source.getValue(ensemble.newCrc)) {
+			return false;
+		}
+		if (layout.hasPatchType && (!source.getValue(patchType) || patchType >= ZUCCHINI_PATCH_TYPE_NUM)) {
+			return false;
+		}
+		if (!source.getValue(elementNum) || elementNum > source.size()) return false;
+
+		// Elements cover the new image one after another
+		uint64_t newPos = 0;
+		for (uint32_t i = 0; i < elementNum; i++) {
+			ElementPatch &element = ensemble.elements.emplace_back();
+			if (!parseElement(source, layout, element)) return false;
+			if (static_cast<uint64_t>(element.oldOffset) + element.oldLength > ensemble.oldSize ||
+			    element.newOffset != newPos) {
+				return false;
+			}
+			newPos += element.newLength;
+		}
+		return newPos == ensemble.newSize && source.empty();
+	}
+
+	/**
+	 * Copies the equivalences from the old element with the extra data in the gaps,
+	 * then adds the raw deltas to the copied bytes.
+	 */
+	static bool applyElement(const uint8_t *oldData, uint8_t *newData, const ElementPatch &element) {
+		PatchSource srcSkip = element.srcSkip;
+		PatchSource dstSkip = element.dstSkip;
+		PatchSource copyCount = element.copyCount;
+		PatchSource extraData = element.extraData;
+		PatchSource extra;
+		std::vector<Equivalence> equivalences;
+		int64_t prevSrcEnd = 0;
+		uint64_t newPos = 0;
+
+		while (!srcSkip.empty() && !dstSkip.empty() && !copyCount.empty()) {
+			uint32_t length, dstDiff;
+			int32_t srcDiff;
+			if (!copyCount.getVarUInt(length) || !srcSkip.getVarInt(srcDiff) || !dstSkip.getVarUInt(dstDiff)) {
+				return false;
+			}
+			const int64_t srcOffset = prevSrcEnd + srcDiff;
+			const uint64_t dstOffset = newPos + dstDiff;
+			if (srcOffset < 0 || srcOffset + length > element.oldLength || dstOffset + length > element.newLength) {
+				return false;
+			}
+			if (!extraData.getRegion(dstDiff, extra)) return false;
+			memcpy(newData + newPos, extra.get(), dstDiff);
+			memcpy(newData + dstOffset, oldData + srcOffset, length);
+			equivalences.emplace_back(srcOffset, dstOffset, length);
+			prevSrcEnd = srcOffset + length;
+			newPos = dstOffset + length;
+		}
+		if (!srcSkip.empty() || !dstSkip.empty() || !copyCount.empty()) return false;
+		if (!extraData.getRegion(element.newLength - newPos, extra) || !extraData.empty()) return false;
+		memcpy(newData + newPos, extra.get(), extra.size());
+
+		// Raw delta offsets count through the equivalences as if they were concatenated
+		PatchSource rawDeltaSkip = element.rawDeltaSkip;
+		PatchSource rawDeltaDiff = element.rawDeltaDiff;
+		uint64_t copyOffsetBase = 0, equivalenceStart = 0;
+		uint64_t index = 0;
+		while (!rawDeltaSkip.empty() && !rawDeltaDiff.empty()) {
+			uint32_t skip;
+			uint8_t diff;
+			if (!rawDeltaSkip.getVarUInt(skip) || !rawDeltaDiff.getValue(diff) || !diff) return false;
+			const uint64_t copyOffset = copyOffsetBase + skip;
+			copyOffsetBase = copyOffset + 1;
+			while (index < equivalences.size() && equivalenceStart + equivalences[index].length <= copyOffset) {
+				equivalenceStart += equivalences[index].length;
+				index++;
+			}
+			if (index == equivalences.size()) return false;
+			newData[equivalences[index].dstOffset + copyOffset - equivalenceStart] += diff;
+		}
+		return rawDeltaSkip.empty() && rawDeltaDiff.empty();
+	}
+
+	static bool brotliDecode(const uint8_t *data, uint64_t size, std::vector<uint8_t> &out) {
+		BrotliDecoderState *state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+		if (!state) return false;
+		BrotliDecoderResult result = BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT;
+		size_t availIn = size;
+		const uint8_t *nextIn = data;
+		uint64_t outPos = 0;
+		out.resize(std::max<uint64_t>(size * 4, BROTLI_MIN_OUTPUT_SIZE));
+		while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+			if (outPos == out.size()) {
+				out.resize(out.size() * 2);
+			}
+			size_t availOut = out.size() - outPos;
+			uint8_t *nextOut = out.data() + outPos;
+			result = BrotliDecoderDecompressStream(state, &availIn, &nextIn, &availOut, &nextOut, nullptr);
+			outPos = nextOut - out.data();
+		}
+		BrotliDecoderDestroyInstance(state);
+		out.resize(outPos);
+		return result == BROTLI_DECODER_RESULT_SUCCESS && availIn == 0;
+	}
+
+	int ZucchiniPatch::apply(const uint8_t *src, uint64_t srcSize, const uint8_t *patch, uint64_t patchSize,
+	                         uint8_t *dest, uint64_t destSize) {
+		std::vector<uint8_t> decoded;
+		uint32_t magic = 0;
+		PatchSource{patch, patchSize}.getValue(magic);
+		if (magic != ZUCCHINI_MAGIC) {
+			if (!brotliDecode(patch, patchSize, decoded)) return -EBADMSG;
+			patch = decoded.data();
+			patchSize = decoded.size();
+		}
+
+		// The layouts are told apart by parsing, every one has to consume the patch exactly
+		EnsemblePatch ensemble;
+		bool isParsed = false;
+		for (const auto &layout: PATCH_LAYOUTS) {
+			ensemble = EnsemblePatch{};
+			isParsed = parseEnsemble(patch, patchSize, layout, ensemble);
+			if (isParsed) break;
+		}
+		if (!isParsed || ensemble.oldSize != srcSize || ensemble.newSize != destSize) return -EBADMSG;
+		for (const auto &element: ensemble.elements) {
+			if (element.exeType != EXE_TYPE_NO_OP) return -ENOTSUP;
+		}
+		if (lzma_crc32(src, srcSize, 0) != ensemble.oldCrc) return -EBADMSG;
+
+		for (const auto &element: ensemble.elements) {
+			if (!applyElement(src + element.oldOffset, dest + element.newOffset, element)) return -EBADMSG;
+		}
+		return lzma_crc32(dest, destSize, 0) == ensemble.newCrc ? 0 : -EBADMSG;
+	}
+}
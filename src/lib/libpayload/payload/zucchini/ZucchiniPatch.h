@@ -0,0 +1,26 @@
+#ifndef PAYLOAD_EXTRACT_ZUCCHINIPATCH_H
+#define PAYLOAD_EXTRACT_ZUCCHINIPATCH_H
+
+#include <cinttypes>
+
+namespace skkk {
+	/**
+	 * Applies a Zucchini ensemble patch: the patch header with the sizes and CRC32 of both images,
+	 * then one element patch per matched region of dest (equivalences copied from src,
+	 * extra data in between, byte deltas over the copies, reference corrections).
+	 * Payloads carry the patch compressed by brotli, a raw patch is taken as well.
+	 * Stateless, safe to run on any number of threads.
+	 */
+	class ZucchiniPatch {
+		public:
+			/**
+			 * -EBADMSG for a broken patch or a size/CRC mismatch of either image,
+			 * -ENOTSUP for elements that need an executable disassembler (PE, ELF, DEX)
+			 * to correct their references.
+			 */
+			static int apply(const uint8_t *src, uint64_t srcSize, const uint8_t *patch, uint64_t patchSize,
+			                 uint8_t *dest, uint64_t destSize);
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_ZUCCHINIPATCH_H
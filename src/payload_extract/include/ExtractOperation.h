@@ -1,20 +1,26 @@
 #ifndef PAYLOAD_EXTRACT_EXTRACTOPERATION_H
 #define PAYLOAD_EXTRACT_EXTRACTOPERATION_H
 
-#include <mutex>
 #include <string>
+#include <vector>
 
 #include <payload/ExtractConfig.h>
 
 namespace skkk {
 	class ExtractOperation : public ExtractConfig {
-		std::mutex _mutex;
-
 		public:
 			bool isPrintAll = false;
 			bool isPrintTarget = false;
 			bool isExtractAll = false;
 			bool isExtractTarget = false;
+			// One line per finished partition: [name:success|fail]
+			int notifyFd = -1;
+			// Merge and verify the output of these shards instead of extracting
+			std::vector<std::string> shardManifests;
+			// One job per line: [input] or [input<TAB>outdir]
+			std::string batchListPath;
+			// Jobs of the batch running at the same time
+			uint32_t batchJobNum = 2;
 
 		public:
 			ExtractOperation() = default;
@@ -24,6 +30,8 @@ namespace skkk {
 				: ExtractConfig(payloadType, payloadPath, oldDir, outDir, sslVerification) {
 			}
 
+			ExtractOperation(const ExtractOperation &) = default;
+
 			int initOldDir() const;
 
 			int initOutDir();
@@ -1,14 +1,26 @@
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <cstring>
+#include <format>
+#include <functional>
+#include <future>
 #include <getopt.h>
+#include <memory>
 #include <print>
 #include <string>
 #include <sys/time.h>
+#include <unistd.h>
+#include <vector>
 
 #include <payload/ExtractConfig.h>
 #include <payload/LogBase.h>
+#include <payload/MemoryBudget.h>
 #include <payload/PartitionWriter.h>
 #include <payload/PayloadParser.h>
 #include <payload/Utils.h>
+#include <payload/common/CpuTopology.h>
+#include <payload/common/io.h>
 #include <payload/verify/VerifyWriter.h>
 
 #include "ExtractOperation.h"
@@ -17,7 +29,7 @@
 using namespace skkk;
 
 static void usage(const ExtractOperation &eo) {
-	char buf[4096] = {};
+	char buf[8192] = {};
 	// @formatter:off
 	snprintf(buf, sizeof(buf) - 1,
 			 BROWN("usage: [options]") "\n"
@@ -36,6 +48,28 @@ static void usage(const ExtractOperation &eo) {
 	         "  " GREEN2_BOLD("-e") "                   " BROWN("Exclude mode, exclude specific targets") "\n"
 	         "  " GREEN2_BOLD("-s") "                   " BROWN("Silent mode, Don't show progress") "\n"
 	         "  " GREEN2_BOLD("-T#") "                  " BROWN("[") GREEN2_BOLD("1-%u") BROWN("] Use # threads, default: -T0, is ") GREEN2_BOLD("%u") "\n"
+	         "  " GREEN2_BOLD("--adaptive-threads") "   " BROWN("Adjust the running threads from the measured throughput") "\n"
+	         "  "             "               "       "      " BROWN("  -T# is the maximum, default: twice the available cpus") "\n"
+	         "  " GREEN2_BOLD("--max-memory=X") "       " BROWN("Memory budget of the running operations: [512M,2G,...]") "\n"
+	         "  " GREEN2_BOLD("--schedule=X") "         " BROWN("Operation order: [manifest,lpt], default: manifest") "\n"
+	         "  "             "               "       "      " BROWN("  lpt: Estimated longest operations first") "\n"
+	         "  " GREEN2_BOLD("--cost-profile=X") "     " BROWN("Calibrate lpt from this file, and update it after extraction") "\n"
+	         "  " GREEN2_BOLD("--cpu-set=X") "          " BROWN("Pin the threads to these cpus: [0-3,8,...]") "\n"
+	         "  " GREEN2_BOLD("--numa") "               " BROWN("Prefer the threads of one numa node for each partition") "\n"
+	         "  " GREEN2_BOLD("--priority=X") "         " BROWN("Extract these partitions first, in this order: [boot,vbmeta,...]") "\n"
+	         "  " GREEN2_BOLD("--notify-fd=X") "        " BROWN("Write [name:success|fail] to this fd once a partition is complete") "\n"
+	         "  " GREEN2_BOLD("--fetch-threads=X") "    " BROWN("URL mode download threads, default: same as -T#") "\n"
+	         "  " GREEN2_BOLD("--shard=i/n") "          " BROWN("Only extract shard i (0 based) of n, balanced by bytes") "\n"
+	         "  "             "               "       "      " BROWN("  Writes the extents of the shard to [outdir/shard_i_of_n.txt]") "\n"
+	         "  "             "               "       "      " BROWN("  Not with --verify-update") "\n"
+	         "  " GREEN2_BOLD("--shard-merge=X") "      " BROWN("Merge and verify the shards: [shard_0_of_2.txt,...]") "\n"
+	         "  " GREEN2_BOLD("--batch=X") "            " BROWN("Extract every payload of this list on one thread pool") "\n"
+	         "  "             "               "       "      " BROWN("  One job per line: [input] or [input<TAB>outdir]") "\n"
+	         "  "             "               "       "      " BROWN("  Default outdir: [outdir/<job index>], other options apply to all") "\n"
+	         "  " GREEN2_BOLD("--batch-jobs=X") "       " BROWN("Jobs running at the same time, default: 2") "\n"
+	         "  " GREEN2_BOLD("--job-threads=X") "      " BROWN("Max threads of the pool used by one job, default: all") "\n"
+	         "  " GREEN2_BOLD("--sparse") "             " BROWN("Write Android sparse images, no raw images in between") "\n"
+	         "  "             "               "       "      " BROWN("  Not with --verify-update, --shard or --shard-merge") "\n"
 	         "  " GREEN2_BOLD("-k") "                   " BROWN("Skip SSL verification") "\n"
 	         "  " GREEN2_BOLD("-o, --outdir=X") "       " BROWN("Output dir") "\n"
 	         "  " GREEN2_BOLD("--out-config=X") "       " BROWN("Output config file, One config per line: [boot:/path/to/xxx]") "\n"
@@ -71,10 +105,25 @@ static option argOptions[] = {
 	{"incremental", required_argument, nullptr, 200},
 	{"verify-update", optional_argument, nullptr, 201},
 	{"out-config",required_argument, nullptr, 202},
+	{"schedule", required_argument, nullptr, 203},
+	{"cost-profile", required_argument, nullptr, 204},
+	{"cpu-set", required_argument, nullptr, 205},
+	{"numa", no_argument, nullptr, 206},
+	{"adaptive-threads", no_argument, nullptr, 207},
+	{"max-memory", required_argument, nullptr, 208},
+	{"priority", required_argument, nullptr, 209},
+	{"notify-fd", required_argument, nullptr, 210},
+	{"fetch-threads", required_argument, nullptr, 211},
+	{"shard", required_argument, nullptr, 212},
+	{"shard-merge", required_argument, nullptr, 213},
+	{"batch", required_argument, nullptr, 214},
+	{"batch-jobs", required_argument, nullptr, 215},
+	{"job-threads", required_argument, nullptr, 216},
+	{"sparse", no_argument, nullptr, 217},
 	{nullptr, no_argument, nullptr, 0},
 };
 
-static int parseExtractOperation(const int argc, char **argv, ExtractOperation &eo) {
+static int parseOptions(const int argc, char **argv, ExtractOperation &eo) {
 	int opt, ret = RET_EXTRACT_CONFIG_FAIL;
 	bool enterCheckOpt = false;
 	while ((opt = getopt_long(argc, argv, "ehi:ko:pst:xP:T:VX:R", argOptions, nullptr)) != -1) {
@@ -164,6 +213,137 @@ static int parseExtractOperation(const int argc, char **argv, ExtractOperation &
 				}
 				LOGCD("outConfigPath={}", eo.getOutConfigPath());
 				break;
+			case 203:
+				if (optarg) {
+					if (strcmp(optarg, "lpt") == 0) {
+						eo.scheduleMode = SCHEDULE_LPT;
+					} else if (strcmp(optarg, "manifest") == 0) {
+						eo.scheduleMode = SCHEDULE_MANIFEST;
+					} else {
+						LOGCE("Unknown schedule: {}", optarg);
+						goto exit;
+					}
+				}
+				LOGCD("scheduleMode={}", eo.scheduleMode);
+				break;
+			case 204:
+				if (optarg) {
+					eo.setCostProfilePath(optarg);
+				}
+				LOGCD("costProfilePath={}", eo.getCostProfilePath());
+				break;
+			case 205:
+				if (optarg) {
+					eo.cpuSet.clear();
+					if (!CpuTopology::parseCpuList(optarg, eo.cpuSet)) {
+						LOGCE("Invalid cpu set: {}", optarg);
+						goto exit;
+					}
+				}
+				LOGCD("cpuSet={}", CpuTopology::formatCpuList(eo.cpuSet));
+				break;
+			case 206:
+				eo.isNumaBind = true;
+				LOGCD("isNumaBind={}", eo.isNumaBind);
+				break;
+			case 207:
+				eo.isAdaptiveThreads = true;
+				LOGCD("isAdaptiveThreads={}", eo.isAdaptiveThreads);
+				break;
+			case 208:
+				if (optarg) {
+					if (!MemoryBudget::parseSize(optarg, eo.maxMemory)) {
+						LOGCE("Invalid memory size: {}", optarg);
+						goto exit;
+					}
+				}
+				LOGCD("maxMemory={}", eo.maxMemory);
+				break;
+			case 209:
+				if (optarg) {
+					std::vector<std::string> priorities;
+					splitString(priorities, optarg, ",", true);
+					eo.setPriorities(priorities);
+				}
+				LOGCD("priorities={}", eo.getPriorities().size());
+				break;
+			case 210:
+				if (optarg) {
+					char *endPtr;
+					eo.notifyFd = strtol(optarg, &endPtr, 0);
+					if (*endPtr != '\0' || eo.notifyFd < 0) {
+						LOGCE("Invalid notify fd: {}", optarg);
+						goto exit;
+					}
+				}
+				LOGCD("notifyFd={}", eo.notifyFd);
+				break;
+			case 211:
+				if (optarg) {
+					char *endPtr;
+					uint64_t n = strtoull(optarg, &endPtr, 0);
+					if (*endPtr != '\0' || n > eo.limitHardwareConcurrency) {
+						LOGCE("Fetch threads min: 1 , max: {}", eo.limitHardwareConcurrency);
+						goto exit;
+					}
+					eo.fetchThreadNum = n;
+				}
+				LOGCD("fetchThreadNum={}", eo.fetchThreadNum);
+				break;
+			case 212:
+				if (optarg) {
+					char *endPtr;
+					eo.shardIndex = strtoul(optarg, &endPtr, 10);
+					if (*endPtr == '/') {
+						eo.shardCount = strtoul(endPtr + 1, &endPtr, 10);
+					}
+					if (*endPtr != '\0' || eo.shardCount == 0 || eo.shardIndex >= eo.shardCount) {
+						LOGCE("Invalid shard: {}, expected: i/n", optarg);
+						goto exit;
+					}
+				}
+				LOGCD("shard={}/{}", eo.shardIndex, eo.shardCount);
+				break;
+			case 213:
+				if (optarg) {
+					splitString(eo.shardManifests, optarg, ",", true);
+				}
+				LOGCD("shardManifests={}", eo.shardManifests.size());
+				break;
+			case 214:
+				if (optarg) {
+					eo.batchListPath = optarg;
+				}
+				LOGCD("batchListPath={}", eo.batchListPath);
+				break;
+			case 215:
+				if (optarg) {
+					char *endPtr;
+					uint64_t n = strtoull(optarg, &endPtr, 0);
+					if (*endPtr != '\0' || n == 0 || n > eo.limitHardwareConcurrency) {
+						LOGCE("Batch jobs min: 1 , max: {}", eo.limitHardwareConcurrency);
+						goto exit;
+					}
+					eo.batchJobNum = n;
+				}
+				LOGCD("batchJobNum={}", eo.batchJobNum);
+				break;
+			case 216:
+				if (optarg) {
+					char *endPtr;
+					uint64_t n = strtoull(optarg, &endPtr, 0);
+					if (*endPtr != '\0' || n > eo.limitHardwareConcurrency) {
+						LOGCE("Job threads min: 1 , max: {}", eo.limitHardwareConcurrency);
+						goto exit;
+					}
+					eo.jobThreadNum = n;
+				}
+				LOGCD("jobThreadNum={}", eo.jobThreadNum);
+				break;
+			case 217:
+				eo.isSparseOutput = true;
+				LOGCD("isSparseOutput={}", eo.isSparseOutput);
+				break;
 			default:
 				usage(eo);
 				printVersion();
@@ -172,57 +352,229 @@ static int parseExtractOperation(const int argc, char **argv, ExtractOperation &
 	}
 
 	if (enterCheckOpt) {
-		if (eo.getPayloadPath().empty()) {
+		ret = RET_EXTRACT_CONFIG_DONE;
+	} else {
+		usage(eo);
+	}
+exit:
+	return ret;
+}
+
+static int initThreadNum(ExtractOperation &eo) {
+	if (eo.threadNum > eo.limitHardwareConcurrency) {
+		LOGCE("Threads min: 1 , max: {}", eo.limitHardwareConcurrency);
+		return RET_EXTRACT_THREAD_NUM_ERROR;
+	}
+	if (eo.threadNum == 0) {
+		// I/O bound runs may use more threads than cpus
+		eo.threadNum = eo.isAdaptiveThreads
+			               ? std::min(eo.hardwareConcurrency * 2, eo.limitHardwareConcurrency)
+			               : eo.hardwareConcurrency;
+	}
+	LOGCD("Threads num={}", eo.threadNum);
+	return RET_EXTRACT_CONFIG_DONE;
+}
+
+static int initExtractOperation(ExtractOperation &eo) {
+	int ret = RET_EXTRACT_CONFIG_FAIL;
+	if (eo.getPayloadPath().empty()) {
+		ret = RET_EXTRACT_OPEN_FILE;
+		goto exit;
+	}
+
+	eo.handleUrl();
+	LOGCD("isUrl={}", eo.isUrl);
+
+	eo.initHttpDownload();
+	LOGCD("httpDownload={}", eo.httpDownload != nullptr);
+
+	if (eo.payloadType != PAYLOAD_TYPE_URL) {
+		if (!fileExists(eo.getPayloadPath())) {
+			LOGCE("payload file '{}' does not exist", eo.getPayloadPath().c_str());
 			ret = RET_EXTRACT_OPEN_FILE;
 			goto exit;
 		}
+	}
 
-		eo.handleUrl();
-		LOGCD("isUrl={}", eo.isUrl);
-
-		eo.initHttpDownload();
-		LOGCD("httpDownload={}", eo.httpDownload != nullptr);
+	if (eo.isIncremental) {
+		ret = eo.initOldDir();
+		if (ret) goto exit;
+	}
 
-		if (eo.payloadType != PAYLOAD_TYPE_URL) {
-			if (!fileExists(eo.getPayloadPath())) {
-				LOGCE("payload file '{}' does not exist", eo.getPayloadPath().c_str());
-				ret = RET_EXTRACT_OPEN_FILE;
-				goto exit;
-			}
-		}
+	ret = eo.initOutDir();
+	if (ret) goto exit;
 
-		if (eo.isIncremental) {
-			ret = eo.initOldDir();
-			if (ret) goto exit;
-		}
+	if (!eo.getOutConfigPath().empty()) {
+		ret = eo.initOutConfig();
+		if (ret) goto exit;
+	}
 
-		ret = eo.initOutDir();
+	if (!eo.getTargetName().empty()) {
+		ret = eo.initTargetNames();
 		if (ret) goto exit;
+	}
 
-		if (!eo.getOutConfigPath().empty()) {
-			ret = eo.initOutConfig();
-			if (ret) goto exit;
-		}
+	ret = initThreadNum(eo);
+exit:
+	return ret;
+}
 
-		if (!eo.getTargetName().empty()) {
-			ret = eo.initTargetNames();
-			if (ret) goto exit;
-		}
+static int parseExtractOperation(const int argc, char **argv, ExtractOperation &eo) {
+	int ret = parseOptions(argc, argv, eo);
+	if (ret != RET_EXTRACT_CONFIG_DONE) return ret;
+	// A shard only writes part of the image, and the output files are shared with the other shards
+	if (eo.shardCount > 1 && eo.isVerifyUpdate) {
+		LOGCE("--shard can't be used with --verify-update");
+		return RET_EXTRACT_CONFIG_FAIL;
+	}
+	// Hash tree, FEC and the shard extents are written to raw image offsets
+	if (eo.isSparseOutput && (eo.isVerifyUpdate || eo.shardCount > 1 || !eo.shardManifests.empty())) {
+		LOGCE("--sparse can't be used with --verify-update, --shard or --shard-merge");
+		return RET_EXTRACT_CONFIG_FAIL;
+	}
+	if (eo.batchListPath.empty()) {
+		return initExtractOperation(eo);
+	}
+	// The jobs are initialized from the list, each with its own input and outdir
+	if (!(eo.isExtractAll || eo.isExtractTarget) || eo.remoteUpdate || !eo.shardManifests.empty()) {
+		LOGCE("Batch mode only supports -x or -X");
+		return RET_EXTRACT_CONFIG_FAIL;
+	}
+	if (eo.isAdaptiveThreads) {
+		// The active thread limit applies to the whole pool, not to one job
+		LOGCI("--adaptive-threads is ignored in batch mode");
+		eo.isAdaptiveThreads = false;
+	}
+	ret = eo.initOutDir();
+	if (ret) return ret;
+	return initThreadNum(eo);
+}
 
-		if (eo.threadNum > eo.limitHardwareConcurrency) {
-			ret = RET_EXTRACT_THREAD_NUM_ERROR;
-			LOGCE("Threads min: 1 , max: {}", eo.limitHardwareConcurrency);
-			goto exit;
+/**
+ * prefix: empty, or [<job index>:] in batch mode
+ */
+static void notifyPartitionDone(int fd, const std::string &prefix, const PartitionInfo &info, bool isSuccessful) {
+	// One write per line, lines from different threads do not interleave on a pipe
+	const std::string line = std::format("{}{}:{}\n", prefix, info.name, isSuccessful ? "success" : "fail");
+	if (write(fd, line.data(), line.size()) < 0) {
+		LOGCE("notify fd {} write fail: {}", fd, strerror(errno));
+	}
+}
+
+struct BatchJob {
+	std::string input;
+	std::string outDir;
+	std::unique_ptr<ExtractOperation> eo;
+	bool isInitialized = false;
+	int ret = RET_EXTRACT_INIT_FAIL;
+};
+
+static bool readBatchList(const std::string &path, const std::string &outDir, std::vector<BatchJob> &jobs) {
+	std::vector<std::string> lines;
+	if (!readAllLines(path, lines)) {
+		LOGCE("Cannot read the batch list: '{}'", path);
+		return false;
+	}
+	for (auto &line: lines) {
+		if (line.ends_with('\r')) line.pop_back();
+		if (line.empty() || line.starts_with('#')) continue;
+		auto &job = jobs.emplace_back();
+		const auto pos = line.find('\t');
+		job.input = line.substr(0, pos);
+		job.outDir = pos != std::string::npos
+			             ? line.substr(pos + 1)
+			             : std::format("{}/{}", outDir, jobs.size() - 1);
+	}
+	return !jobs.empty();
+}
+
+static int runBatchJob(BatchJob &job, uint64_t index, const std::shared_ptr<std::threadpool> &threadPool) {
+	auto &eo = *job.eo;
+	PayloadParser payloadParser;
+	payloadParser.setThreadPool(threadPool);
+	if (!payloadParser.parse(eo)) {
+		return RET_EXTRACT_INIT_FAIL;
+	}
+	const auto pw = payloadParser.getPartitionWriter();
+	if (!(eo.getTargetName().empty() ? pw->initPartitions() : pw->initPartitionsByTarget())) {
+		LOGCE("{}: Cannot find the image file to be extracted!", job.input);
+		return RET_EXTRACT_INIT_PART_FAIL;
+	}
+	const auto vw = pw->getVerifyWriter();
+	vw->initHashTreeLevel();
+	if (eo.createExtractOutDir()) {
+		return RET_EXTRACT_CREATE_DIR_FAIL;
+	}
+	const std::string prefix = std::format("{}:", index);
+	if (eo.notifyFd >= 0 && !(eo.isIncremental && eo.isVerifyUpdate)) {
+		pw->setPartitionDoneCallback([fd = eo.notifyFd, &prefix](const PartitionInfo &info, bool isSuccessful) {
+			notifyPartitionDone(fd, prefix, info, isSuccessful);
+		});
+	}
+	pw->extractPartitions();
+	if (eo.isIncremental && eo.isVerifyUpdate) {
+		vw->updateVerifyData();
+		if (eo.notifyFd >= 0) {
+			for (const auto &info: pw->getPartitions()) {
+				notifyPartitionDone(eo.notifyFd, prefix, info, info.isExtractionSuccessful);
+			}
 		}
-		if (eo.threadNum == 0) {
-			eo.threadNum = eo.hardwareConcurrency;
+	}
+	return std::ranges::all_of(pw->getPartitions(), std::identity{}, &PartitionInfo::isExtractionSuccessful)
+		       ? RET_EXTRACT_DONE
+		       : RET_EXTRACT_FAIL_EXIT;
+}
+
+/**
+ * One process and one pool for every payload of the list: protobuf, the CA lookup and the
+ * workers are only set up once. batchJobNum jobs run at the same time, their operations go to
+ * the same pool, so the next payload keeps the workers busy while the previous one drains.
+ */
+static int runBatch(const ExtractOperation &eo) {
+	int ret = RET_EXTRACT_DONE;
+	std::vector<BatchJob> jobs;
+	if (!readBatchList(eo.batchListPath, eo.getOutDir(), jobs)) {
+		return RET_EXTRACT_INIT_FAIL;
+	}
+	for (auto &job: jobs) {
+		// The options of the batch apply to every job, the list sets the input and outdir
+		job.eo = std::make_unique<ExtractOperation>(eo);
+		auto &jobEo = *job.eo;
+		jobEo.batchListPath.clear();
+		jobEo.setPayloadPath(job.input);
+		jobEo.setOutDir(job.outDir);
+		jobEo.threadNum = eo.threadNum;
+		jobEo.isAdaptiveThreads = false;
+		// Progress bars of concurrent jobs would overwrite each other
+		jobEo.isSilent = eo.isSilent || eo.batchJobNum > 1;
+		job.isInitialized = initExtractOperation(jobEo) == RET_EXTRACT_CONFIG_DONE;
+	}
+
+	const auto threadPool = PayloadParser::createThreadPool(eo);
+	std::atomic_uint64_t nextJob = 0;
+	auto runJobs = [&jobs, &nextJob, &threadPool] {
+		for (uint64_t i; (i = nextJob++) < jobs.size();) {
+			auto &job = jobs[i];
+			if (!job.isInitialized) continue;
+			LOGCI(GREEN2_BOLD("Starting job ") RED2("{}") ": {}", i, job.input);
+			job.ret = runBatchJob(job, i, threadPool);
 		}
-		LOGCD("Threads num={}", eo.threadNum);
-		ret = RET_EXTRACT_CONFIG_DONE;
-	} else {
-		usage(eo);
+	};
+	std::vector<std::future<void>> drivers;
+	const uint64_t jobNum = std::min<uint64_t>(eo.batchJobNum, jobs.size());
+	for (uint64_t i = 0; i < jobNum; i++) {
+		drivers.emplace_back(std::async(std::launch::async, runJobs));
+	}
+	for (auto &driver: drivers) {
+		driver.wait();
+	}
+
+	for (uint64_t i = 0; i < jobs.size(); i++) {
+		const bool isSuccessful = jobs[i].ret == RET_EXTRACT_DONE;
+		LOGCI("job {:<4} {}" BROWN2_BOLD(" result: ") "{}",
+		      i, jobs[i].input, isSuccessful ? GREEN2_BOLD("success") : RED2("fail"));
+		if (!isSuccessful) ret = RET_EXTRACT_FAIL_EXIT;
 	}
-exit:
 	return ret;
 }
 
@@ -291,6 +643,11 @@ int main(const int argc, char *argv[]) {
 		goto exit;
 	}
 
+	if (!eo.batchListPath.empty()) {
+		ret = runBatch(eo);
+		goto end;
+	}
+
 	// RemoteUpdater
 	ru = std::make_shared<RemoteUpdater>(eo);
 	if (eo.remoteUpdate) {
@@ -348,10 +705,29 @@ int main(const int argc, char *argv[]) {
 			ru->startMonitor();
 		}
 
+		// Hash tree and FEC are only written after all partitions, notify after that
+		if (eo.notifyFd >= 0 && !(eo.isIncremental && eo.isVerifyUpdate)) {
+			pw->setPartitionDoneCallback([fd = eo.notifyFd](const PartitionInfo &info, bool isSuccessful) {
+				notifyPartitionDone(fd, "", info, isSuccessful);
+			});
+		}
+
+		if (!eo.shardManifests.empty()) {
+			if (!pw->mergeShards(eo.shardManifests)) {
+				ret = RET_EXTRACT_FAIL_EXIT;
+			}
+			goto end;
+		}
+
 		pw->extractPartitions();
 
 		if (eo.isIncremental && eo.isVerifyUpdate) {
 			vw->updateVerifyData();
+			if (eo.notifyFd >= 0) {
+				for (const auto &info: pw->getPartitions()) {
+					notifyPartitionDone(eo.notifyFd, "", info, info.isExtractionSuccessful);
+				}
+			}
 		}
 		goto end;
 	}